@@ -2,22 +2,39 @@
 
 using namespace llvm;
 
+static cl::opt<unsigned>
+NoAliasTimeBudget("add-noalias-time-budget", cl::init(0),
+                  cl::desc("Seconds add-noalias may take before it stops cloning (0: no limit)"));
+
+static cl::opt<unsigned>
+NoAliasMemoryBudget("add-noalias-memory-budget", cl::init(0),
+                    cl::desc("Megabytes add-noalias may use before it stops cloning (0: no limit)"));
+
+static cl::opt<double>
+NoAliasColdRatio("add-noalias-cold-ratio", cl::init(0),
+                 cl::desc("Share the regions of a function that run less than this ratio of its calls between it and its clone (0: clone whole functions)"));
+
 void AddNoalias::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<PADriver>();
+  AU.addRequired<BlockFrequencyInfo>();
+  AU.addRequired<DominatorTree>();
   AU.setPreservesAll();
 }
 
-AddNoalias::AddNoalias() : ModulePass(ID) {
+AddNoalias::AddNoalias() : ModulePass(ID), budget("add-noalias") {
   NoAliasPotentialFunctions = 0;
   NoAliasClonedFunctions = 0;
   NoAliasPotentialCalls = 0;
   NoAliasClonedCalls = 0;
   NoAliasTotalCalls = 0;
+  NoAliasNoCaptureArgs = 0;
 }
 
 bool AddNoalias::runOnModule(Module &M) {
 
   PAD = &getAnalysis<PADriver>();
+  budget.reset(NoAliasTimeBudget, NoAliasMemoryBudget);
+
   // Collect information
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (!F->isDeclaration()) {
@@ -32,7 +49,7 @@ bool AddNoalias::runOnModule(Module &M) {
         if (!isa<CallInst>(U) && !isa<InvokeInst>(U)) continue;
 
         CallSite CS(cast<Instruction>(U));
-        if (!CS.isCallee(UI)) continue;
+        if (!CS.isCallee(UI) || isColdCall(CS)) continue;
 
         if (F->arg_empty()) break;
 
@@ -68,8 +85,18 @@ bool AddNoalias::cloneFunctions() {
     Function *f                = it->first;
     std::vector<User*> callers = it->second;
 
+    // Keep the clones made so far, but do not make new ones
+    if (budget.exceeded()) {
+      budget.degrade("stopped creating noalias clones");
+      break;
+    }
+
     NoAliasPotentialCalls += f->getNumUses();
 
+    if (NoAliasColdRatio > 0) {
+      partial.outlineColdRegions(*f, getAnalysis<BlockFrequencyInfo>(*f),
+                                 getAnalysis<DominatorTree>(*f), NoAliasColdRatio);
+    }
     Function* NF = cloneFunctionWithNoAliasArgs(f);
     clonedFunctions[f] = NF;
 
@@ -81,6 +108,7 @@ bool AddNoalias::cloneFunctions() {
     Function *original = it->first;
     Function *clonedFn = it->second;
     fillCloneContent(original, clonedFn);
+    if (NoAliasColdRatio > 0) partial.recordClone(clonedFn, original);
   }
   return NoAliasClonedFunctions > 0;
 }
@@ -102,10 +130,10 @@ void AddNoalias::fillCloneContent(Function* original, Function* clonedFn) {
 Function* AddNoalias::cloneFunctionWithNoAliasArgs(Function *Fn) {
 
   // Start by computing a new prototype for the function, which is the
-  // same as the old function
-  Function *NF = Function::Create(Fn->getFunctionType(), Fn->getLinkage());
+  // same as the old function. Every module makes the same noalias clone,
+  // so the linker may fold them.
+  Function *NF = Function::Create(Fn->getFunctionType(), getCloneLinkage(Fn));
   NF->copyAttributesFrom(Fn);
-
   // After the parameters have been copied, we should copy the parameter
   // names, to ease function inspection afterwards.
   Function::arg_iterator NFArg = NF->arg_begin();
@@ -115,6 +143,7 @@ Function* AddNoalias::cloneFunctionWithNoAliasArgs(Function *Fn) {
     // We should also add NoAlias attr to parameters that are pointers
     if (NFArg->getType()->isPointerTy()) {
       AttrBuilder noalias(Attribute::get(NFArg->getContext(), Attribute::NoAlias));
+      addArgumentAttributes(Arg, noalias);
       int argNo = NFArg->getArgNo() + 1;
       NFArg->addAttr(AttributeSet::get(NFArg->getContext(), argNo, noalias));
     }
@@ -129,6 +158,15 @@ Function* AddNoalias::cloneFunctionWithNoAliasArgs(Function *Fn) {
   return NF;
 }
 
+// Add the attributes the function proves for its pointer argument A.
+// readonly and readnone are function attributes in LLVM 3.3, and the
+// verifier rejects them on parameters, so only nocapture is inferred.
+void AddNoalias::addArgumentAttributes(Argument *A, AttrBuilder &B) {
+  if (PointerMayBeCaptured(A, true, true)) return;
+  B.addAttribute(Attribute::NoCapture);
+  NoAliasNoCaptureArgs++;
+}
+
 // replace calling instruction
 void AddNoalias::substCallingInstructions(Function* NF, std::vector<User*> callers) {
   for (std::vector<User*>::iterator it = callers.begin(); it != callers.end(); ++it) {
@@ -140,10 +178,12 @@ void AddNoalias::substCallingInstructions(Function* NF, std::vector<User*> calle
       InvokeInst *invokeInst = dyn_cast<InvokeInst>(caller);
       invokeInst->setCalledFunction(NF);
     }
+    modRef.invalidate(cast<Instruction>(caller)->getParent()->getParent());
   }
 }
 
-// collect function to clone
+// collect function to clone. Noalias only helps callees that write to
+// memory, as reads may always be reordered.
 void AddNoalias::collectFn2Clone() {
 
   for (std::map< User*, std::vector< std::pair<Argument*, Value*> > >::iterator fit = arguments.begin(); fit != arguments.end(); ++fit) {
@@ -161,38 +201,96 @@ void AddNoalias::collectFn2Clone() {
     // verify, for every actual argument, if its possible values collide with others arguments values
     int intersectionCount = 0;
     for (std::vector< std::pair<Argument*, Value*> >::iterator it = args.begin(); it != args.end(); ++it) {
-      std::set<int> myValues = argsValues[it->second];
-
-      for (std::vector< std::pair<Argument*, Value*> >::iterator it2 = args.begin(); it2 != args.end(); ++it2) {
-        if (*it2 == *it) continue;
-        if (intersectionCount != 0) break;
-
-        std::set<int> otherValues = argsValues[it2->second];
-        std::vector<int> intersection(myValues.size() + otherValues.size());
-        std::vector<int>::iterator intersectionIt = std::set_intersection(myValues.begin(), myValues.end(), otherValues.begin(), otherValues.end(), intersection.begin());
-        intersection.resize(intersectionIt - intersection.begin());
-        intersectionCount += intersection.size();
+      const std::set<int> &myValues = argsValues[it->second];
 
+      for (std::vector< std::pair<Argument*, Value*> >::iterator it2 = it + 1; it2 != args.end(); ++it2) {
+        if (intersects(myValues, argsValues[it2->second])) {
+          intersectionCount++;
+          break;
+        }
       }
       if (intersectionCount != 0) break;
     }
 
-    if (intersectionCount == 0 && args.size() > 1) {
-      if (isa<CallInst>(caller)) {
-        CallInst *callInst = dyn_cast<CallInst>(caller);
-        Function* f        = callInst->getCalledFunction();
-        if (!f->hasAvailableExternallyLinkage()) {
-          fn2Clone[f].push_back(caller);
-        }
-      } else if (isa<InvokeInst>(caller)) {
-        InvokeInst *invokeInst = dyn_cast<InvokeInst>(caller);
-        Function* f            = invokeInst->getCalledFunction();
-        if (!f->hasAvailableExternallyLinkage()) {
-          fn2Clone[f].push_back(caller);
-        }
+    if (intersectionCount != 0 || args.empty()) continue;
+
+    CallSite CS(cast<Instruction>(caller));
+    Function* f = CS.getCalledFunction();
+    if (f->hasAvailableExternallyLinkage()) continue;
+
+    const FunctionModRef &S = modRef.get(f);
+    if (!S.writesMemory()) continue;
+
+    // A lone pointer argument can only be told apart from the globals the
+    // callee accesses, and from the memory reached through it; anything
+    // else it accesses might be the argument memory
+    if (args.size() == 1) {
+      if (S.readsUnknown || S.writesUnknown || getAccessedGlobals(S).empty()) continue;
+      if (!isDisjointFromReach(argsValues.begin()->second)) continue;
+    }
+    if (!isDisjointFromGlobals(argsValues, S)) continue;
+
+    fn2Clone[f].push_back(caller);
+  }
+}
+
+// Globals the function of summary S reads or writes
+std::set<const GlobalVariable*> AddNoalias::getAccessedGlobals(const FunctionModRef &S) {
+  std::set<const GlobalVariable*> globals;
+  for (std::set<const Value*>::const_iterator it = S.read.begin(); it != S.read.end(); ++it) {
+    if (const GlobalVariable *G = dyn_cast<GlobalVariable>(*it)) globals.insert(G);
+  }
+  for (std::set<const Value*>::const_iterator it = S.written.begin(); it != S.written.end(); ++it) {
+    if (const GlobalVariable *G = dyn_cast<GlobalVariable>(*it)) globals.insert(G);
+  }
+  return globals;
+}
+
+// Whether no argument points to the memory of a global the callee accesses
+bool AddNoalias::isDisjointFromGlobals(std::map<Value*, std::set<int> > &argsValues, const FunctionModRef &S) {
+  std::set<const GlobalVariable*> globals = getAccessedGlobals(S);
+
+  for (std::set<const GlobalVariable*>::iterator G = globals.begin(); G != globals.end(); ++G) {
+    std::set<int> blocks = PAD->pointerAnalysis->pointsTo(PAD->Value2Int(const_cast<GlobalVariable*>(*G)));
+
+    // Nested structs have their fields as blocks of their own
+    std::vector<int> worklist(blocks.begin(), blocks.end());
+    while (!worklist.empty()) {
+      int block = worklist.back();
+      worklist.pop_back();
+
+      std::map<int, std::vector<int> >::iterator fields = PAD->memoryBlock2.find(block);
+      if (fields == PAD->memoryBlock2.end()) continue;
+      for (unsigned i = 0; i < fields->second.size(); ++i) {
+        if (blocks.insert(fields->second[i]).second) worklist.push_back(fields->second[i]);
       }
     }
+
+    for (std::map<Value*, std::set<int> >::iterator it = argsValues.begin(); it != argsValues.end(); ++it) {
+      if (intersects(it->second, blocks)) return false;
+    }
+  }
+
+  return true;
+}
+
+// Whether the memory reached by following the pointers stored in the
+// blocks of values is disjoint from them
+bool AddNoalias::isDisjointFromReach(const std::set<int> &values) {
+  std::set<int> reach;
+  std::vector<int> worklist(values.begin(), values.end());
+
+  while (!worklist.empty()) {
+    int n = worklist.back();
+    worklist.pop_back();
+
+    std::set<int> pointees = PAD->pointerAnalysis->pointsTo(n);
+    for (std::set<int>::iterator it = pointees.begin(); it != pointees.end(); ++it) {
+      if (reach.insert(*it).second) worklist.push_back(*it);
+    }
   }
+
+  return !intersects(values, reach);
 }
 
 void AddNoalias::print(raw_ostream& O, const Module* M) const {
@@ -201,6 +299,9 @@ void AddNoalias::print(raw_ostream& O, const Module* M) const {
   O << "Number of cloned functions: " << NoAliasClonedFunctions << '\n';
   O << "Number of potential calls: " << NoAliasPotentialCalls << '\n';
   O << "Number of calls replaced: " << NoAliasClonedCalls << '\n';
+  O << "Number of nocapture arguments: " << NoAliasNoCaptureArgs << '\n';
+  budget.print(O);
+  partial.print(O);
 }
 
 // Register the pass to the LLVM framework
@@ -13,10 +13,16 @@
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "../utils/CloneNaming.h"
+#include "../utils/ColdFunctions.h"
+#include "../utils/ModRefSummary.h"
+#include "../utils/PartialCloning.h"
 #include "PADriver.h"
+#include "SetKernels.h"
 
 #undef DEBUG_TYPE
 #define DEBUG_TYPE "add-noalias"
@@ -26,6 +32,7 @@ namespace llvm {
   STATISTIC(NoAliasTotalCalls,         "Number of calls");
   STATISTIC(NoAliasPotentialCalls,     "Number of promissor calls");
   STATISTIC(NoAliasClonedCalls,        "Number of replaced calls");
+  STATISTIC(NoAliasNoCaptureArgs,      "Number of nocapture clone arguments");
 
   class AddNoalias : public ModulePass {
 
@@ -34,11 +41,18 @@ namespace llvm {
     std::map< Function*, std::vector<User*> > fn2Clone;
 
     PADriver* PAD;
+    CompileBudget budget;
+    PartialCloning partial;
+    ModRefSummary modRef;
     void collectFn2Clone();
     bool cloneFunctions();
     void fillCloneContent(Function* original, Function* clonedFn);
     void substCallingInstructions(Function* NF, std::vector<User*> callers);
     Function* cloneFunctionWithNoAliasArgs(Function *Fn);
+    void addArgumentAttributes(Argument *A, AttrBuilder &B);
+    std::set<const GlobalVariable*> getAccessedGlobals(const FunctionModRef &S);
+    bool isDisjointFromGlobals(std::map<Value*, std::set<int> > &argsValues, const FunctionModRef &S);
+    bool isDisjointFromReach(const std::set<int> &values);
 
    public:
 
@@ -0,0 +1,318 @@
+#include "HeapToStack.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+HeapToStackMaxSize("heap-to-stack-max-size", cl::init(4096),
+                   cl::desc("Largest heap allocation, in bytes, heap-to-stack moves to the stack"));
+
+static cl::opt<bool>
+HeapToStackWholeProgram("heap-to-stack-whole-program", cl::init(false),
+                        cl::desc("Trust a closed world pointer analysis: the module is the whole program"));
+
+static cl::opt<unsigned>
+HeapToStackTimeBudget("heap-to-stack-time-budget", cl::init(0),
+                      cl::desc("Seconds heap-to-stack may take before it stops looking for allocations (0: no limit)"));
+
+static cl::opt<unsigned>
+HeapToStackMemoryBudget("heap-to-stack-memory-budget", cl::init(0),
+                        cl::desc("Megabytes heap-to-stack may use before it stops looking for allocations (0: no limit)"));
+
+// Whether CS calls the library function of the given name
+static bool isCallTo(CallSite CS, StringRef name) {
+  Function *F = CS.getCalledFunction();
+  return F && F->isDeclaration() && F->getName() == name;
+}
+
+void HeapToStack::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<PADriver>();
+  AU.addRequired<LoopInfo>();
+}
+
+HeapToStack::HeapToStack() : ModulePass(ID), budget("heap-to-stack") {
+  HeapToStackAllocations = 0;
+  HeapToStackPromoted = 0;
+  HeapToStackFrees = 0;
+  HeapToStackClones = 0;
+}
+
+bool HeapToStack::runOnModule(Module &M) {
+
+  PAD = &getAnalysis<PADriver>();
+
+  // Under a closed world the arguments of external functions point to
+  // nothing, so memory they return to other modules through an out
+  // parameter looks local. Only trust that when told the module is the
+  // whole program.
+  if (PAD->closedWorld && !HeapToStackWholeProgram) {
+    errs() << "heap-to-stack: skipped, the pointer analysis assumed a closed world; "
+           << "use -pa-closed-world=false or -heap-to-stack-whole-program\n";
+    return false;
+  }
+
+  budget.reset(HeapToStackTimeBudget, HeapToStackMemoryBudget);
+
+  collectCalls(M);
+  computeGlobalReach(M);
+
+  // Decide everything before changing the module, as the pointer analysis
+  // knows the memory blocks by their allocation
+  std::vector<Promotion> promotions;
+  for (std::vector<CallInst*>::iterator it = allocations.begin(); it != allocations.end(); ++it) {
+    CallInst *CI = *it;
+
+    if (budget.exceeded()) {
+      budget.degrade("stopped looking for allocations to move to the stack");
+      break;
+    }
+
+    Promotion P;
+    P.allocation = CI;
+    P.size       = getAllocationSize(CI);
+    if (P.size == 0) continue;
+    HeapToStackAllocations++;
+
+    if (P.size > HeapToStackMaxSize || !PAD->memoryBlock.count(CI)) continue;
+    if (canPromote(CI, PAD->memoryBlock[CI][0], P)) {
+      promotions.push_back(P);
+    }
+  }
+
+  for (std::vector<Promotion>::iterator it = promotions.begin(); it != promotions.end(); ++it) {
+    promote(*it);
+  }
+
+  return !promotions.empty();
+}
+
+void HeapToStack::collectCalls(Module &M) {
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+      for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+        CallSite CS(I);
+        if (!CS) continue;
+
+        if (isa<CallInst>(I) && (isCallTo(CS, "malloc") || isCallTo(CS, "calloc"))) {
+          allocations.push_back(cast<CallInst>(I));
+        } else if ((isCallTo(CS, "free") || isCallTo(CS, "realloc")) && CS.arg_size() > 0) {
+          deallocations.push_back(I);
+        }
+      }
+    }
+  }
+}
+
+// Add to reach every block reachable from the nodes in worklist
+void HeapToStack::addReach(std::set<int> &reach, std::vector<int> worklist) {
+  while (!worklist.empty()) {
+    int n = worklist.back();
+    worklist.pop_back();
+
+    std::set<int> pointees = PAD->pointerAnalysis->pointsTo(n);
+    for (std::set<int>::iterator it = pointees.begin(); it != pointees.end(); ++it) {
+      if (reach.insert(*it).second) worklist.push_back(*it);
+    }
+  }
+}
+
+void HeapToStack::computeGlobalReach(Module &M) {
+  std::vector<int> worklist;
+  worklist.push_back(PAD->unknownPtr);
+
+  for (Module::global_iterator G = M.global_begin(), E = M.global_end(); G != E; ++G) {
+    worklist.push_back(PAD->Value2Int(G));
+  }
+
+  addReach(globalReach, worklist);
+}
+
+const std::set<int>& HeapToStack::getFunctionReach(Function *F) {
+  std::map<Function*, std::set<int> >::iterator it = functionReach.find(F);
+  if (it != functionReach.end()) return it->second;
+
+  std::vector<int> worklist;
+  for (Function::arg_iterator A = F->arg_begin(), E = F->arg_end(); A != E; ++A) {
+    if (PAD->containsPointer(A->getType())) worklist.push_back(PAD->Value2Int(A));
+  }
+
+  if (PAD->containsPointer(F->getReturnType())) {
+    for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+      if (ReturnInst *RI = dyn_cast<ReturnInst>(BB->getTerminator())) {
+        worklist.push_back(PAD->Value2Int(RI->getReturnValue()));
+      }
+    }
+  }
+
+  std::set<int> &reach = functionReach[F];
+  addReach(reach, worklist);
+  return reach;
+}
+
+bool HeapToStack::pointsOnlyTo(Value *V, int block) {
+  std::set<int> pointees = PAD->pointerAnalysis->pointsTo(PAD->Value2Int(V));
+  return pointees.size() == 1 && *pointees.begin() == block;
+}
+
+// Whether the memory block allocated by CI dies with the function that
+// allocates it, and every call that frees it can be removed
+bool HeapToStack::canPromote(CallInst *CI, int block, Promotion &P) {
+  Function *F = CI->getParent()->getParent();
+
+  if (globalReach.count(block)) return false;
+  if (getFunctionReach(F).count(block)) return false;
+
+  for (std::vector<Instruction*>::iterator it = deallocations.begin(); it != deallocations.end(); ++it) {
+    Instruction *D = *it;
+    CallSite CS(D);
+    Value *ptr = CS.getArgument(0);
+
+    if (!PAD->pointerAnalysis->pointsTo(PAD->Value2Int(ptr)).count(block)) continue;
+    if (isCallTo(CS, "realloc") || isa<InvokeInst>(D)) return false;
+
+    Function *H = D->getParent()->getParent();
+    if (H == F) {
+      if (!pointsOnlyTo(ptr, block)) return false;
+      P.frees.push_back(D);
+      continue;
+    }
+
+    // Freed by a helper, through one of its arguments, which we clone for
+    // the calls of F that pass only this block
+    Argument *A = dyn_cast<Argument>(ptr->stripPointerCasts());
+    if (!A || H->mayBeOverridden()) return false;
+    unsigned argNo = A->getArgNo();
+
+    for (Value::use_iterator UI = H->use_begin(), E = H->use_end(); UI != E; ++UI) {
+      CallSite HCS(*UI);
+      if (!HCS || !HCS.isCallee(UI) || HCS.arg_size() <= argNo) return false;
+
+      Value *actual = HCS.getArgument(argNo);
+      if (!PAD->pointerAnalysis->pointsTo(PAD->Value2Int(actual)).count(block)) continue;
+
+      Instruction *Call = HCS.getInstruction();
+      if (Call->getParent()->getParent() != F || !pointsOnlyTo(actual, block)) return false;
+
+      std::map<Instruction*, unsigned>::iterator call = P.helperCalls.find(Call);
+      if (call != P.helperCalls.end() && call->second != argNo) return false;
+      P.helperCalls[Call] = argNo;
+    }
+  }
+
+  // Allocations in loops share one stack slot across the iterations, so
+  // each iteration must free its memory before the block ends
+  LoopInfo &LI = getAnalysis<LoopInfo>(*F);
+  if (LI.getLoopFor(CI->getParent())) {
+    BasicBlock::iterator I = CI;
+    for (BasicBlock::iterator E = CI->getParent()->end(); I != E; ++I) {
+      if (std::find(P.frees.begin(), P.frees.end(), &*I) != P.frees.end()) break;
+    }
+    if (I == CI->getParent()->end()) return false;
+  }
+
+  return true;
+}
+
+void HeapToStack::promote(Promotion &P) {
+  CallInst *CI = P.allocation;
+  Function *F  = CI->getParent()->getParent();
+  bool zeroed  = isCallTo(CallSite(CI), "calloc");
+
+  Type *Ty = ArrayType::get(Type::getInt8Ty(CI->getContext()), P.size);
+  AllocaInst *AI = new AllocaInst(Ty, 0, 16, CI->getName() + ".stack", &*F->getEntryBlock().getFirstInsertionPt());
+  Value *ptr = new BitCastInst(AI, CI->getType(), "", CI);
+
+  if (zeroed) {
+    IRBuilder<> Builder(CI);
+    Builder.CreateMemSet(ptr, Builder.getInt8(0), P.size, 16);
+  }
+
+  CI->replaceAllUsesWith(ptr);
+  CI->eraseFromParent();
+
+  for (std::vector<Instruction*>::iterator it = P.frees.begin(); it != P.frees.end(); ++it) {
+    (*it)->eraseFromParent();
+    HeapToStackFrees++;
+  }
+
+  for (std::map<Instruction*, unsigned>::iterator it = P.helperCalls.begin(); it != P.helperCalls.end(); ++it) {
+    CallSite CS(it->first);
+    CS.setCalledFunction(getNoFreeClone(CS.getCalledFunction(), it->second));
+  }
+
+  HeapToStackPromoted++;
+}
+
+// Clone of helper that does not free its argNo-th argument
+Function* HeapToStack::getNoFreeClone(Function *helper, unsigned argNo) {
+  std::pair<Function*, unsigned> key(helper, argNo);
+  std::map<std::pair<Function*, unsigned>, Function*>::iterator it = noFreeClones.find(key);
+  if (it != noFreeClones.end()) return it->second;
+
+  std::string name = getCloneName(helper->getName(), ".nofree", utostr(argNo));
+  Function *NF = helper->getParent()->getFunction(name);
+
+  if (!NF) {
+    ValueToValueMapTy VMap;
+    NF = CloneFunction(helper, VMap, false);
+    NF->setLinkage(getCloneLinkage(helper));
+    NF->setName(name);
+    helper->getParent()->getFunctionList().insert(helper, NF);
+
+    Function::arg_iterator A = NF->arg_begin();
+    std::advance(A, argNo);
+
+    std::vector<Instruction*> frees;
+    for (Function::iterator BB = NF->begin(), E = NF->end(); BB != E; ++BB) {
+      for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+        CallSite CS(I);
+        if (CS && isa<CallInst>(I) && isCallTo(CS, "free") &&
+            CS.getArgument(0)->stripPointerCasts() == A) {
+          frees.push_back(I);
+        }
+      }
+    }
+    for (std::vector<Instruction*>::iterator I = frees.begin(); I != frees.end(); ++I) {
+      (*I)->eraseFromParent();
+      HeapToStackFrees++;
+    }
+
+    HeapToStackClones++;
+  }
+
+  noFreeClones[key] = NF;
+  return NF;
+}
+
+// Size in bytes of a malloc or calloc of a constant size, 0 otherwise
+uint64_t HeapToStack::getAllocationSize(CallInst *CI) {
+  CallSite CS(CI);
+  uint64_t limit = uint64_t(HeapToStackMaxSize) + 1;
+
+  if (isCallTo(CS, "malloc") && CS.arg_size() == 1) {
+    if (ConstantInt *C = dyn_cast<ConstantInt>(CS.getArgument(0))) {
+      return C->getLimitedValue(limit);
+    }
+  } else if (isCallTo(CS, "calloc") && CS.arg_size() == 2) {
+    ConstantInt *N    = dyn_cast<ConstantInt>(CS.getArgument(0));
+    ConstantInt *Size = dyn_cast<ConstantInt>(CS.getArgument(1));
+    if (N && Size) {
+      return N->getLimitedValue(limit) * Size->getLimitedValue(limit);
+    }
+  }
+
+  return 0;
+}
+
+void HeapToStack::print(raw_ostream& O, const Module* M) const {
+  O << "Number of fixed size heap allocations: " << HeapToStackAllocations << '\n';
+  O << "Number of allocations moved to the stack: " << HeapToStackPromoted << '\n';
+  O << "Number of removed calls to free: " << HeapToStackFrees << '\n';
+  O << "Number of helpers cloned without their free: " << HeapToStackClones << '\n';
+  budget.print(O);
+}
+
+// Register the pass to the LLVM framework
+char HeapToStack::ID = 0;
+static RegisterPass<HeapToStack> X("heap-to-stack", "Move non-escaping heap allocations to the stack.", false, false);
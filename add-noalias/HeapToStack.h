@@ -0,0 +1,85 @@
+#include <sstream>
+#include <ios>
+#include <fstream>
+#include <string>
+#include <iostream>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <iterator>
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "../utils/CloneNaming.h"
+#include "PADriver.h"
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "heap-to-stack"
+namespace llvm {
+  STATISTIC(HeapToStackAllocations, "Number of fixed size heap allocations");
+  STATISTIC(HeapToStackPromoted,    "Number of heap allocations moved to the stack");
+  STATISTIC(HeapToStackFrees,       "Number of removed calls to free");
+  STATISTIC(HeapToStackClones,      "Number of helpers cloned without their free");
+
+  // Turns malloc and calloc calls of a fixed, small size whose memory never
+  // outlives the allocating function into allocas. The memory must not be
+  // reachable from globals, from code we do not see, from the arguments or
+  // from the return value of the function, according to the pointer
+  // analysis. Calls to free on it are removed; when a helper frees it, the
+  // helper is cloned without the free. The pointer analysis must see every
+  // caller of external functions, so the pass only runs with an open world
+  // analysis or when told the module is the whole program.
+  class HeapToStack : public ModulePass {
+
+    // A promotable allocation and what frees it
+    struct Promotion {
+      CallInst *allocation;
+      uint64_t size;
+      std::vector<Instruction*> frees;
+      std::map<Instruction*, unsigned> helperCalls;
+    };
+
+    PADriver* PAD;
+    CompileBudget budget;
+
+    std::vector<CallInst*> allocations;
+    std::vector<Instruction*> deallocations;
+
+    // Memory blocks reachable from globals or from unknown code
+    std::set<int> globalReach;
+
+    // Memory blocks reachable from the arguments or return values, by function
+    std::map<Function*, std::set<int> > functionReach;
+
+    std::map<std::pair<Function*, unsigned>, Function*> noFreeClones;
+
+    void collectCalls(Module &M);
+    void addReach(std::set<int> &reach, std::vector<int> worklist);
+    void computeGlobalReach(Module &M);
+    const std::set<int>& getFunctionReach(Function *F);
+    bool pointsOnlyTo(Value *V, int block);
+    bool canPromote(CallInst *CI, int block, Promotion &P);
+    void promote(Promotion &P);
+    Function* getNoFreeClone(Function *helper, unsigned argNo);
+    uint64_t getAllocationSize(CallInst *CI);
+
+   public:
+
+    static char ID;
+
+    HeapToStack();
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
+    bool runOnModule(Module &M);
+    virtual void print(raw_ostream& O, const Module* M) const;
+  };
+}
@@ -28,6 +28,26 @@
 
 using namespace llvm;
 
+static cl::opt<unsigned>
+PATimeBudget("pa-time-budget", cl::init(0),
+             cl::desc("Seconds the pointer analysis may take before degrading (0: no limit)"));
+
+static cl::opt<unsigned>
+PAMemoryBudget("pa-memory-budget", cl::init(0),
+               cl::desc("Megabytes the pointer analysis may use before degrading (0: no limit)"));
+
+static cl::opt<int>
+PASCCPeriod("pa-scc-period", cl::init(0),
+            cl::desc("Solver steps between cycle sweeps (0: the number of vertices, negative: no sweeps)"));
+
+static cl::opt<bool>
+PATypeFilter("pa-type-filter", cl::init(false),
+             cl::desc("Only let loads and stores move pointers between values and memory of compatible types"));
+
+static cl::opt<bool>
+PAClosedWorld("pa-closed-world", cl::init(true),
+              cl::desc("Assume the module is the whole program, so only main is called from outside"));
+
 // ============================= //
 
 bool PADriver::runOnModule(Module &M) {
@@ -37,7 +57,12 @@ bool PADriver::runOnModule(Module &M) {
 	// Get Time before analysis
 	//getrusage(RUSAGE_SELF, &ru);
 	//startTime = ru.ru_utime;
-	if (pointerAnalysis == 0) pointerAnalysis = new PointerAnalysis();
+	releaseMemory();
+	pointerAnalysis = new PointerAnalysis();
+	pointerAnalysis->setTypeFilter(PATypeFilter);
+	budget.reset(PATimeBudget, PAMemoryBudget);
+	closedWorld = PAClosedWorld;
+	addUnknownConstraints();
 
    // Collect information from global variables
    for (Module::global_iterator git = M.global_begin(), gitE = M.global_end();
@@ -46,6 +71,13 @@ bool PADriver::runOnModule(Module &M) {
       //errs() << "    -> " << git->getType()->isStructTy() << "\n";
       handleGlobalVariable(git);
    }
+
+   // Initializers may point to any global, so they go after all of them
+   for (Module::global_iterator git = M.global_begin(), gitE = M.global_end();
+         git != gitE; ++git) {
+      handleGlobalInitializer(git);
+   }
+
    
    // Collect information from functions
 	for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
@@ -53,11 +85,30 @@ bool PADriver::runOnModule(Module &M) {
 			addConstraints(*F);
 			matchFormalWithActualParameters(*F);
 			matchReturnValueWithReturnVariable(*F);
+
+			// Functions called from code we do not see get unknown arguments
+			bool calledFromOutside = F->getName() == "main" ||
+				(!closedWorld && !F->hasLocalLinkage());
+			if (calledFromOutside || isAddressTaken(*F)) handleAddressTakenFunction(*F);
 		}
 	}
 
 	// Run the analysis
-	pointerAnalysis->solve(false);
+	if (PASCCPeriod >= 0) {
+		unsigned period = PASCCPeriod ? PASCCPeriod : pointerAnalysis->getNumVertices();
+		pointerAnalysis->setCycleSweepPeriod(period ? period : 1);
+	}
+	pointerAnalysis->solve(false, &budget);
+	PADegradations = budget.getDegradations().size();
+
+	const std::vector<int> &sweeps = pointerAnalysis->getCycleSweeps();
+	for (unsigned i = 0; i < sweeps.size(); i++) {
+		DEBUG(errs() << "Cycle sweep " << i << ": " << sweeps[i] << " vertices collapsed\n");
+		PASweepMerges += sweeps[i];
+	}
+	PASweeps = sweeps.size();
+	PAFilteredEdges = pointerAnalysis->getNumFilteredEdges();
+	PAArenaUsage = SolverArena::get().getBytesReserved() / 1024;
 #ifndef _WIN32
 	double vmUsage, residentSet;
 	process_mem_usage(vmUsage, residentSet);
@@ -89,6 +140,31 @@ bool PADriver::runOnModule(Module &M) {
 
 // ============================= //
 
+// The solver and the maps of the driver are dropped once the passes that
+// use the analysis are done with it; running again starts from scratch
+void PADriver::releaseMemory() {
+	delete pointerAnalysis;
+	pointerAnalysis = 0;
+
+	value2int.clear();
+	valMap.clear();
+	valMem.clear();
+	nameMap.clear();
+	memoryBlock.clear();
+	memoryBlock2.clear();
+	phiValues.clear();
+	memoryBlocks.clear();
+	typeIds.clear();
+
+	currInd = 0;
+	nextMemoryBlock = 1;
+	numInst = 0;
+	unknownPtr = 0;
+	unknownBlock = 0;
+}
+
+// ============================= //
+
 // Get the int ID of a new memory space
 int PADriver::getNewMem(std::string name) {
 
@@ -106,6 +182,8 @@ int PADriver::getNewMem(std::string name) {
 // ============================= //
 
 void PADriver::print(raw_ostream& O, const Module* M) const {
+	if (pointerAnalysis == 0) return;
+
 	std::stringstream dotFileSS;
 	DEBUG( pointerAnalysis->print() );
 	pointerAnalysis->printDot(dotFileSS, M->getModuleIdentifier(), nameMap);
@@ -188,29 +266,8 @@ void PADriver::addConstraints(Function &F) {
 	for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
 		for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
          numInst++;
-			if (isa<CallInst>(I)) {
-				CallInst *CI = dyn_cast<CallInst>(I);
-
-				if (CI) {
-					Function *FF = CI->getCalledFunction();
-
-					if (FF && (FF->getName() == "malloc" || FF->getName() == "realloc" ||
-								FF->getName() == "calloc")) {
-						std::vector<int> mems;
-
-						if (!memoryBlock.count(I)) {
-							mems.push_back(getNewMemoryBlock());
-							memoryBlock[I] = mems;
-						} else {
-							mems = memoryBlock[I];
-						}
-
-						int a = Value2Int(I);
-						pointerAnalysis->addAddr(a, mems[0]);
-						PAAddrCt++;
-					}
-				}
-			}
+			CallSite CS(I);
+			if (CS) handleCallSite(CS);
 
 			// Handle special operations
 			switch (I->getOpcode()) {
@@ -264,7 +321,7 @@ void PADriver::addConstraints(Function &F) {
 						Value *v = SI->getValueOperand();
 						Value *ptr = SI->getPointerOperand();
 
-						if (v->getType()->isPointerTy()) {
+						if (containsPointer(v->getType())) {
 							int a = Value2Int(ptr);
 							int b = Value2Int(v);
 
@@ -311,6 +368,63 @@ void PADriver::addConstraints(Function &F) {
 						pointerAnalysis->addLoad(a, b);
 						PALoadCt++;
 
+						// *ptr = new
+						Value *v = LI->getNewValOperand();
+						if (v->getType()->isPointerTy()) {
+							pointerAnalysis->addStore(b, Value2Int(v));
+							PAStoreCt++;
+						}
+
+						break;
+					}
+				case Instruction::Select:
+					{
+						// I = c ? x : y
+						if (containsPointer(I->getType())) {
+							int a = Value2Int(I);
+							pointerAnalysis->addBase(a, Value2Int(I->getOperand(1)));
+							pointerAnalysis->addBase(a, Value2Int(I->getOperand(2)));
+							PABaseCt += 2;
+						}
+
+						break;
+					}
+				case Instruction::PtrToInt:
+					{
+						// We do not track integers, so the pointer escapes
+						addEscape(I->getOperand(0));
+						break;
+					}
+				case Instruction::IntToPtr:
+				case Instruction::VAArg:
+				case Instruction::LandingPad:
+					{
+						// Values we know nothing about
+						if (containsPointer(I->getType())) {
+							pointerAnalysis->addBase(Value2Int(I), unknownPtr);
+							PABaseCt++;
+						}
+
+						break;
+					}
+				case Instruction::ExtractValue:
+				case Instruction::InsertValue:
+				case Instruction::ExtractElement:
+				case Instruction::InsertElement:
+				case Instruction::ShuffleVector:
+					{
+						// Aggregates and vectors are a single node holding
+						// every pointer they contain
+						if (containsPointer(I->getType())) {
+							int a = Value2Int(I);
+							for (User::op_iterator it = I->op_begin(), e = I->op_end(); it != e; ++it) {
+								if (containsPointer((*it)->getType())) {
+									pointerAnalysis->addBase(a, Value2Int(*it));
+									PABaseCt++;
+								}
+							}
+						}
+
 						break;
 					}
 				case Instruction::PHI:
@@ -368,18 +482,252 @@ void PADriver::addConstraints(Function &F) {
 
 // ============================= //
 
+void PADriver::addUnknownConstraints() {
+	unknownPtr = getNewInt();
+	unknownBlock = getNewMemoryBlock();
+	nameMap[unknownPtr] = "unknown";
+	nameMap[unknownBlock] = "unknown memory";
+
+	// U = &UB, and whatever U points to may hold, or be reached from,
+	// anything else U points to: *U = U, U = *U
+	pointerAnalysis->addAddr(unknownPtr, unknownBlock);
+	pointerAnalysis->addStore(unknownPtr, unknownPtr);
+	pointerAnalysis->addLoad(unknownPtr, unknownPtr);
+	PAAddrCt++;
+	PAStoreCt++;
+	PALoadCt++;
+}
+
+// ============================= //
+
+// Whatever v points to becomes reachable from code we do not see
+void PADriver::addEscape(Value *v) {
+	pointerAnalysis->addBase(unknownPtr, Value2Int(v));
+	PABaseCt++;
+	PAEscapeCt++;
+}
+
+// ============================= //
+
+// *dst = *src
+void PADriver::addCopy(Value *dst, Value *src) {
+	int t = getNewInt();
+	pointerAnalysis->addLoad(t, Value2Int(src));
+	pointerAnalysis->addStore(Value2Int(dst), t);
+	PALoadCt++;
+	PAStoreCt++;
+}
+
+// ============================= //
+
+void PADriver::handleCallSite(CallSite CS) {
+	Instruction *I = CS.getInstruction();
+
+	if (isa<DbgInfoIntrinsic>(I)) return;
+
+	if (MemTransferInst *MTI = dyn_cast<MemTransferInst>(I)) {
+		addCopy(MTI->getRawDest(), MTI->getRawSource());
+		return;
+	}
+
+	Function *FF = CS.getCalledFunction();
+
+	// Other intrinsics do not reach into memory through their arguments
+	if (FF && FF->isIntrinsic()) {
+		if (containsPointer(I->getType())) {
+			pointerAnalysis->addBase(Value2Int(I), unknownPtr);
+			PABaseCt++;
+		}
+		return;
+	}
+
+	if (FF) {
+		StringRef name = FF->getName();
+
+		if (name == "malloc" || name == "realloc" || name == "calloc" ||
+				name == "strdup" || name == "_Znwm" || name == "_Znam" ||
+				name == "_Znwj" || name == "_Znaj") {
+			std::vector<int> mems;
+
+			if (!memoryBlock.count(I)) {
+				mems.push_back(getNewMemoryBlock());
+				memoryBlock[I] = mems;
+			} else {
+				mems = memoryBlock[I];
+			}
+
+			int a = Value2Int(I);
+			pointerAnalysis->addAddr(a, mems[0]);
+			PAAddrCt++;
+
+			// The old contents move to the new block
+			if (name == "realloc") {
+				addCopy(I, CS.getArgument(0));
+				pointerAnalysis->addBase(a, Value2Int(CS.getArgument(0)));
+				PABaseCt++;
+			}
+			return;
+		}
+
+		if (name == "free") return;
+
+		if (name == "memcpy" || name == "memmove") {
+			addCopy(CS.getArgument(0), CS.getArgument(1));
+			pointerAnalysis->addBase(Value2Int(I), Value2Int(CS.getArgument(0)));
+			PABaseCt++;
+			return;
+		}
+
+		if (name == "memset") {
+			pointerAnalysis->addBase(Value2Int(I), Value2Int(CS.getArgument(0)));
+			PABaseCt++;
+			return;
+		}
+
+		// Formals and return values of the functions we see are matched
+		// with the actual ones, except the variadic arguments
+		if (!FF->isDeclaration() && !FF->mayBeOverridden()) {
+			for (unsigned i = FF->arg_size(); i < CS.arg_size(); i++) {
+				if (containsPointer(CS.getArgument(i)->getType()))
+					addEscape(CS.getArgument(i));
+			}
+			return;
+		}
+	}
+
+	// External, overridable and indirect calls
+	for (CallSite::arg_iterator it = CS.arg_begin(), E = CS.arg_end(); it != E; ++it) {
+		if (containsPointer((*it)->getType()))
+			addEscape(*it);
+	}
+
+	if (containsPointer(I->getType())) {
+		pointerAnalysis->addBase(Value2Int(I), unknownPtr);
+		PABaseCt++;
+	}
+}
+
+// ============================= //
+
+// n is the node of CE
+void PADriver::handleConstantExpr(ConstantExpr *CE, int n) {
+	switch (CE->getOpcode()) {
+		case Instruction::PtrToInt:
+			addEscape(CE->getOperand(0));
+			break;
+		case Instruction::IntToPtr:
+			pointerAnalysis->addBase(n, unknownPtr);
+			PABaseCt++;
+			break;
+		default:
+			// Casts, field-insensitive GEPs, selects and so on
+			for (User::op_iterator it = CE->op_begin(), E = CE->op_end(); it != E; ++it) {
+				if (containsPointer((*it)->getType())) {
+					pointerAnalysis->addBase(n, Value2Int(*it));
+					PABaseCt++;
+				}
+			}
+			break;
+	}
+}
+
+// ============================= //
+
+void PADriver::handleGlobalInitializer(GlobalVariable *G) {
+	int a = Value2Int(G);
+
+	// Defined elsewhere: holds anything
+	if (!G->hasInitializer()) {
+		pointerAnalysis->addStore(a, unknownPtr);
+		PAStoreCt++;
+		return;
+	}
+
+	// Aggregates are a single object, so every pointer they hold is
+	// stored in it
+	std::vector<Constant*> worklist;
+	worklist.push_back(G->getInitializer());
+
+	while (!worklist.empty()) {
+		Constant *C = worklist.back();
+		worklist.pop_back();
+
+		if (isa<GlobalValue>(C) || isa<ConstantExpr>(C)) {
+			// Integer expressions are not stored, but may leak a pointer
+			int b = Value2Int(C);
+			if (C->getType()->isPointerTy()) {
+				pointerAnalysis->addStore(a, b);
+				PAStoreCt++;
+			}
+			continue;
+		}
+
+		for (User::op_iterator it = C->op_begin(), E = C->op_end(); it != E; ++it)
+			worklist.push_back(cast<Constant>(*it));
+	}
+}
+
+// ============================= //
+
+// F may be called from code we do not see
+void PADriver::handleAddressTakenFunction(Function &F) {
+	for (Function::arg_iterator A = F.arg_begin(), E = F.arg_end(); A != E; ++A) {
+		if (containsPointer(A->getType())) {
+			pointerAnalysis->addBase(Value2Int(A), unknownPtr);
+			PABaseCt++;
+		}
+	}
+
+	if (!containsPointer(F.getReturnType())) return;
+
+	for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+		if (ReturnInst *RI = dyn_cast<ReturnInst>(BB->getTerminator())) {
+			addEscape(RI->getReturnValue());
+		}
+	}
+}
+
+// ============================= //
+
+bool PADriver::isAddressTaken(Function &F) {
+	return F.hasAddressTaken();
+}
+
+// ============================= //
+
+bool PADriver::containsPointer(Type *Ty) {
+	if (Ty->isPointerTy()) return true;
+
+	if (StructType *StTy = dyn_cast<StructType>(Ty)) {
+		for (unsigned i = 0; i < StTy->getNumElements(); i++) {
+			if (containsPointer(StTy->getElementType(i))) return true;
+		}
+		return false;
+	}
+
+	if (SequentialType *SeqTy = dyn_cast<SequentialType>(Ty))
+		return containsPointer(SeqTy->getElementType());
+
+	return false;
+}
+
+// ============================= //
+
 void PADriver::matchFormalWithActualParameters(Function &F) {
 	if (F.arg_empty() || F.use_empty()) return;
 
 	for (Value::use_iterator UI = F.use_begin(), E = F.use_end(); UI != E; ++UI) {
 		User *U = *UI;
 
+		// Other uses take the address of F, which handleAddressTakenFunction
+		// takes care of
 		if (isa<BlockAddress>(U)) continue;
-		if (!isa<CallInst>(U) && !isa<InvokeInst>(U)) return;
+		if (!isa<CallInst>(U) && !isa<InvokeInst>(U)) continue;
 
 		CallSite CS(cast<Instruction>(U));
 		if (!CS.isCallee(UI))
-			return;
+			continue;
+		if (CS.arg_size() < F.arg_size()) continue;
 
 		CallSite::arg_iterator actualArgIter = CS.arg_begin();
 		Function::arg_iterator formalArgIter = F.arg_begin();
@@ -422,7 +770,7 @@ void PADriver::matchReturnValueWithReturnVariable(Function &F) {
 
 		for (std::set<Value*>::iterator it = retVals.begin(), E = retVals.end(); it != E; ++it) {
 
-			int a = Value2Int(CS.getCalledFunction());
+			int a = Value2Int(Call);
 			int b = Value2Int(*it);
 			pointerAnalysis->addBase(a, b);
 			PABaseCt++;
@@ -455,6 +803,10 @@ void PADriver::handleAlloca(Instruction *I) {
 
 				if (StTy->getElementType(i)->isStructTy())
 					handleNestedStructs(StTy->getElementType(i), mems[i]);
+				if (!isTypeAgnostic(StTy))
+					setBlockType(mems[i], StTy->getElementType(i));
+			} else {
+				setBlockType(mems[i], Ty);
 			}
 		}
 
@@ -473,7 +825,7 @@ void PADriver::handleAlloca(Instruction *I) {
 // ============================= //
 
 void PADriver::handleGlobalVariable(GlobalVariable *G) {
-   const Type *Ty = G->getType();
+   const Type *Ty = G->getType()->getElementType();
 
    std::vector<int> mems;
    unsigned numElems = 1;
@@ -494,6 +846,10 @@ void PADriver::handleGlobalVariable(GlobalVariable *G) {
 
             if (StTy->getElementType(i)->isStructTy())
                handleNestedStructs(StTy->getElementType(i), mems[i]);
+            if (!isTypeAgnostic(StTy))
+               setBlockType(mems[i], StTy->getElementType(i));
+         } else {
+            setBlockType(mems[i], Ty);
          }
       }
 
@@ -512,6 +868,20 @@ void PADriver::handleGlobalVariable(GlobalVariable *G) {
 // ============================= //
 
 void PADriver::handleGetElementPtr(Instruction *I) {
+   // The field-sensitive handling only knows about the objects it created
+   // the fields of. Anything else is pointed to field-insensitively.
+   if (!handleFieldGetElementPtr(I)) {
+      GetElementPtrInst *GEPI = dyn_cast<GetElementPtrInst>(I);
+      int a = Value2Int(I);
+      int b = Value2Int(GEPI->getPointerOperand());
+      pointerAnalysis->addBase(a, b);
+      PABaseCt++;
+   }
+}
+
+// ============================= //
+
+bool PADriver::handleFieldGetElementPtr(Instruction *I) {
 
    //errs() << "INSIDE GetElementPtrInst \n";
 
@@ -519,6 +889,7 @@ void PADriver::handleGetElementPtr(Instruction *I) {
    Value *v = GEPI->getPointerOperand();
    const PointerType *PoTy = cast<PointerType>(GEPI->getPointerOperandType());
    const Type *Ty = PoTy->getElementType();
+   bool added = false;
 
    if (Ty->isStructTy()) {
       if (phiValues.count(v)) {
@@ -549,6 +920,7 @@ void PADriver::handleGetElementPtr(Instruction *I) {
                      if (pos < mems.size()) {
                         pointerAnalysis->addAddr(a, mems[pos]);
                         PAAddrCt++;
+                        added = true;
                      }
                   }
                }
@@ -585,6 +957,7 @@ void PADriver::handleGetElementPtr(Instruction *I) {
                               if (pos < mems2.size()) {
                                  pointerAnalysis->addAddr(a, mems2[pos]);
                                  PAAddrCt++;
+                                 added = true;
                               }
                            }
                         }
@@ -612,13 +985,14 @@ void PADriver::handleGetElementPtr(Instruction *I) {
                         if (pos < mems.size()) {
                            pointerAnalysis->addAddr(a, mems[pos]);
                            PAAddrCt++;
+                           added = true;
                         }
                      }
                   }
                } else {
                   GetElementPtrInst *GEPI2 = dyn_cast<GetElementPtrInst>(vv);
 
-                  if (!GEPI2) return;
+                  if (!GEPI2) return added;
 
                   Value *v2 = GEPI2->getPointerOperand();
 
@@ -660,6 +1034,7 @@ void PADriver::handleGetElementPtr(Instruction *I) {
                               if (pos2 < mems2.size()) {
                                  pointerAnalysis->addAddr(a, mems2[pos2]);
                                  PAAddrCt++;
+                                 added = true;
                                  memoryBlock[v] = mems2;
                               }
                            }
@@ -703,6 +1078,7 @@ void PADriver::handleGetElementPtr(Instruction *I) {
                         if (pos < mems2.size()) {
                            pointerAnalysis->addAddr(a, mems2[pos]);
                            PAAddrCt++;
+                           added = true;
                         }
                      }
                   }
@@ -730,13 +1106,14 @@ void PADriver::handleGetElementPtr(Instruction *I) {
                   if (pos < mems.size()) {
                      pointerAnalysis->addAddr(a, mems[pos]);
                      PAAddrCt++;
+                     added = true;
                   }
                }
             }
          } else {
             GetElementPtrInst *GEPI2 = dyn_cast<GetElementPtrInst>(v);
 
-            if (!GEPI2) return;
+            if (!GEPI2) return added;
 
             Value *v2 = GEPI2->getPointerOperand();
 
@@ -778,6 +1155,7 @@ void PADriver::handleGetElementPtr(Instruction *I) {
                         if (pos2 < mems2.size()) {
                            pointerAnalysis->addAddr(a, mems2[pos2]);
                            PAAddrCt++;
+                           added = true;
                            memoryBlock[v] = mems2;
                         }
                      }
@@ -793,7 +1171,10 @@ void PADriver::handleGetElementPtr(Instruction *I) {
       int b = Value2Int(v);
       pointerAnalysis->addBase(a, b);
       PABaseCt++;
+      added = true;
    }
+
+   return added;
 }
 
 // ============================= //2
@@ -808,6 +1189,8 @@ void PADriver::handleNestedStructs(const Type *Ty, int parent) {
 
 		if (StTy->getElementType(i)->isStructTy())
 			handleNestedStructs(StTy->getElementType(i), mems[i]);
+		if (!isTypeAgnostic(StTy))
+			setBlockType(mems[i], StTy->getElementType(i));
 	}
 
 	memoryBlock2[parent] = mems;
@@ -820,6 +1203,64 @@ void PADriver::handleNestedStructs(const Type *Ty, int parent) {
 
 // ============================= //
 
+// Types whose memory may hold anything: chars, unions, functions and
+// structs we do not know the layout of
+bool PADriver::isTypeAgnostic(const Type *Ty) {
+	if (Ty->isIntegerTy(8) || Ty->isFunctionTy()) return true;
+
+	if (const StructType *StTy = dyn_cast<StructType>(Ty)) {
+		return StTy->isOpaque() || StTy->isLiteral() || StTy->getName().startswith("union.");
+	}
+	return false;
+}
+
+// ============================= //
+
+static const Type* stripArrays(const Type *Ty) {
+	while (const ArrayType *ATy = dyn_cast<ArrayType>(Ty)) Ty = ATy->getElementType();
+	return Ty;
+}
+
+// ============================= //
+
+// Type number of the values of type Ty for the type filter, 0 when the
+// filter does not tell them apart. Pointers are numbered by their pointee.
+int PADriver::getTypeId(const Type *Ty) {
+	if (!Ty->isPointerTy()) return 0;
+	return getPointeeTypeId(cast<PointerType>(Ty)->getElementType());
+}
+
+// ============================= //
+
+int PADriver::getPointeeTypeId(const Type *Pointee) {
+	Pointee = stripArrays(Pointee);
+	if (isTypeAgnostic(Pointee)) return 0;
+
+	std::map<const Type*, int>::iterator it = typeIds.find(Pointee);
+	if (it != typeIds.end()) return it->second;
+
+	int id = typeIds.size() + 1;
+	typeIds[Pointee] = id;
+
+	// A pointer to a struct is also a pointer to its first field
+	if (const StructType *StTy = dyn_cast<StructType>(Pointee)) {
+		if (StTy->getNumElements() > 0) {
+			pointerAnalysis->addTypePrefix(id, getPointeeTypeId(StTy->getElementType(0)));
+		}
+	}
+
+	return id;
+}
+
+// ============================= //
+
+// Record what the memory block holds, for the type filter
+void PADriver::setBlockType(int block, const Type *Ty) {
+	if (PATypeFilter) pointerAnalysis->setNodeType(block, getTypeId(stripArrays(Ty)));
+}
+
+// ============================= //
+
 int PADriver::getNewMemoryBlock() {
 	return nextMemoryBlock++;
 }
@@ -841,8 +1282,17 @@ int PADriver::Value2Int(Value *v) {
 
 	n = getNewInt();
 	value2int[v] = n;
+	if (PATypeFilter) pointerAnalysis->setNodeType(n, getTypeId(v->getType()));
 	//int2value[n] = v;
 
+	// Constant expressions and aliases are pointers to what they are made of
+	if (ConstantExpr *CE = dyn_cast<ConstantExpr>(v)) {
+		handleConstantExpr(CE, n);
+	} else if (GlobalAlias *GA = dyn_cast<GlobalAlias>(v)) {
+		pointerAnalysis->addBase(n, Value2Int(GA->getAliasee()));
+		PABaseCt++;
+	}
+
 	// Also get a name for it
 	if (v->hasName()) {
 		nameMap[n] = v->getName();
@@ -10,11 +10,16 @@
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/Use.h"
 #include "llvm/IR/Operator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalAlias.h"
 
+#include "../utils/CompileBudget.h"
 #include "PointerAnalysis.h"
 
 namespace llvm {
@@ -27,6 +32,12 @@ STATISTIC(PANumVert, "Counts number of vertices");
 STATISTIC(PAMerges,  "Counts number of merged vertices");
 STATISTIC(PARemoves, "Counts number of calls to remove cycle");
 STATISTIC(PAMemUsage, "kB of memory");
+STATISTIC(PADegradations, "Counts number of compile budget degradations");
+STATISTIC(PAEscapeCt, "Counts number of values that escape to unknown memory");
+STATISTIC(PASweeps, "Counts number of cycle sweeps");
+STATISTIC(PASweepMerges, "Counts number of vertices collapsed by cycle sweeps");
+STATISTIC(PAArenaUsage, "kB taken by the solver arena");
+STATISTIC(PAFilteredEdges, "Counts number of times the type filter dropped an edge");
 
 class PADriver : public ModulePass {
 	public:
@@ -45,13 +56,27 @@ class PADriver : public ModulePass {
 	std::map<int, std::vector<int> > memoryBlock2;
 	std::map<Value*, std::vector<Value*> > phiValues;
 	std::map<Value*, std::vector<std::vector<int> > > memoryBlocks;
+
+	// Type numbers for the type filter, by pointee type
+	std::map<const Type*, int> typeIds;
    unsigned int numInst;
 
+	// Pointer to everything that escapes the analysis: memory reached through
+	// integers, external code or indirect calls. Its only own block stands
+	// for memory the module does not allocate.
+	int unknownPtr;
+	int unknownBlock;
+
+	// Whether the analysis assumed that only main is called from outside,
+	// so the arguments of other external functions point to nothing
+	bool closedWorld;
+
 	static char ID;
 	PointerAnalysis* pointerAnalysis;
+	CompileBudget budget;
 
-	PADriver() : ModulePass(ID) {
-		pointerAnalysis = new PointerAnalysis();
+	PADriver() : ModulePass(ID), budget("pa") {
+		pointerAnalysis = 0;
 		currInd = 0;
 		nextMemoryBlock = 1;
 
@@ -63,20 +88,37 @@ class PADriver : public ModulePass {
 		PARemoves = 0;
 		PAMerges = 0;
 		PAMemUsage = 0;
+		PADegradations = 0;
+		PAEscapeCt = 0;
+		PASweeps = 0;
+		PASweepMerges = 0;
+		PAArenaUsage = 0;
+		PAFilteredEdges = 0;
       numInst = 0;
+		unknownPtr = 0;
+		unknownBlock = 0;
+		closedWorld = false;
 	}
 
 	// +++++ METHODS +++++ //
 
+	~PADriver() { releaseMemory(); }
+
 	bool runOnModule(Module &M);
+	virtual void releaseMemory();
 	int Value2Int(Value* v);
 	int getNewMem(std::string name);
 	int getNewInt(); 
 	int getNewMemoryBlock();
 	void handleNestedStructs(const Type *Ty, int parent);
+	bool isTypeAgnostic(const Type *Ty);
+	int getTypeId(const Type *Ty);
+	int getPointeeTypeId(const Type *Pointee);
+	void setBlockType(int block, const Type *Ty);
 	void handleAlloca(Instruction *I);
    void handleGlobalVariable(GlobalVariable *G);
    void handleGetElementPtr(Instruction *I);
+   bool handleFieldGetElementPtr(Instruction *I);
 	//Value* Int2Value(int);
 	virtual void print(raw_ostream& O, const Module* M) const;
 	std::string intToStr(int v);
@@ -84,6 +126,15 @@ class PADriver : public ModulePass {
 	void process_mem_usage(double& vm_usage, double& resident_set);
 #endif
 	void addConstraints(Function &F);
+	void addUnknownConstraints();
+	void addEscape(Value *v);
+	void addCopy(Value *dst, Value *src);
+	void handleCallSite(CallSite CS);
+	void handleConstantExpr(ConstantExpr *CE, int n);
+	void handleGlobalInitializer(GlobalVariable *G);
+	void handleAddressTakenFunction(Function &F);
+	bool isAddressTaken(Function &F);
+	bool containsPointer(Type *Ty);
 	void matchFormalWithActualParameters(Function &F);
 	void matchReturnValueWithReturnVariable(Function &F);
 
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <list>
 #include <queue>
 #include <stack>
@@ -7,7 +8,9 @@
 #include "llvm/ADT/SparseBitVector.h"
 #include "llvm/ADT/IndexedMap.h"
 
+#include "../utils/CompileBudget.h"
 #include "PointerAnalysis.h"
+#include "SetKernels.h"
 
 const bool debug = false;
 int teste = 1;
@@ -20,6 +23,9 @@ PointerAnalysis::PointerAnalysis()
     if (debug) std::cerr << "Initializing Pointer Analysis" << std::endl;
 	numMerged = 0;
 	numCallsRemove = 0;
+	sweepPeriod = 0;
+	typeFilter = false;
+	numFiltered = 0;
 }
 
 // ============================================= //
@@ -108,8 +114,9 @@ std::set<int> PointerAnalysis::pointsTo(int A)
 {
     if (debug) std::cerr << "Recovering Points-to-set of "<< A << std::endl;
 
-	int repA = vertices[A];
-	return pointsToSet[repA];
+	int repA = find(A);
+	const IntSet &pts = pointsToSet[repA];
+	return std::set<int>(pts.begin(), pts.end());
 }
 
 // ============================================= //
@@ -203,7 +210,7 @@ void PointerAnalysis::cycleSearch(int source, int target) {
 		for (n = from[current].begin(); n != from[current].end(); ++n) {
 
 			// Get the representative
-			int repN = vertices[*n];
+			int repN = find(*n);
 
 
 			// Add it to the search queue, if not there yet
@@ -243,109 +250,229 @@ void PointerAnalysis::cycleSearch(int source, int target) {
 
 // ============================================= //
 
-void PointerAnalysis::removeCycles()
+/**
+ * Collapse every cycle of the graph. This is the iterative version of
+ * Pearce's space-efficient SCC algorithm, over dense arrays, so that long
+ * copy chains do not overflow the stack. The representatives of the
+ * collapsed cycles are added to targets, and the number of collapsed
+ * vertices is returned.
+ */
+int PointerAnalysis::removeCycles(IntSet *targets)
 {
     if (debug) std::cerr << "Running cycle removal algorithm" << std::endl;
 
 	numCallsRemove++;
 
-    // Some needed variables
-    IntMap order;
-    IntMap repr;
-    int i = 0;
-    IntSet current;
-    IntDeque S;
-
-    // At first, no node is visited and their representatives are themselves
-    if (debug) std::cerr << ">> Initializing structures" << std::endl;
-    IntSet::iterator V;
-    for (V = activeVertices.begin(); V != activeVertices.end(); V++)
-	{
-        order[*V] = 0;
-        repr[*V] = *V;
-    }
+    // Number the active vertices densely. They come sorted from the set, so
+    // a binary search maps ids back.
+    std::vector<int> ids(activeVertices.begin(), activeVertices.end());
+    int n = ids.size();
 
-    // Visit all unvisited nodes
-    if (debug) std::cerr << ">> Visiting vertices" << std::endl;
-    for (V = activeVertices.begin(); V != activeVertices.end(); V++)
+    std::vector< std::vector<int> > succs(n);
+    for (int i = 0; i < n; i++)
 	{
-        if (order[*V] == 0)
+        IntSet::iterator w;
+        for (w = from[ids[i]].begin(); w != from[ids[i]].end(); w++)
 		{
-            visit(*V, order, repr, i, current, S);
+            int repW = find(*w);
+            if (repW == ids[i]) continue;
+            std::vector<int>::iterator j = std::lower_bound(ids.begin(), ids.end(), repW);
+            if (j != ids.end() && *j == repW) succs[i].push_back(j - ids.begin());
         }
     }
 
-    // Merge those whose representatives are not themselves
-    if (debug) std::cerr << ">> Merging vertices" << std::endl;
-    for (V = activeVertices.begin(); V != activeVertices.end(); )
+    // rindex is 0 for unvisited vertices, the visit index for the vertices
+    // being visited, and the component id, counted down from n, for the
+    // finished ones. Component ids are always above the visit indexes.
+    std::vector<int> rindex(n, 0);
+    std::vector<bool> root(n, false);
+    std::vector<unsigned> nextEdge(n, 0);
+    std::vector<int> visiting;
+    std::vector<int> S;
+    int index = 1;
+    int c = n;
+
+    for (int s = 0; s < n; s++)
 	{
-        IntSet::iterator nextIt = V;
-        nextIt++;
-        if (debug) std::cerr << " * Current V (Before): " << *V << std::endl;
-        if (debug) std::cerr << " * Current nextIt (Before): " << *nextIt << std::endl;
-        if (repr[*V] != *V) 
+        if (rindex[s] != 0) continue;
+
+        visiting.push_back(s);
+        root[s] = true;
+        rindex[s] = index++;
+
+        while (!visiting.empty())
 		{
-            merge(*V, repr[*V]);
+            int v = visiting.back();
+
+            if (nextEdge[v] < succs[v].size())
+			{
+                int w = succs[v][nextEdge[v]];
+                if (rindex[w] == 0)
+				{
+                    // The edge is finished when w is
+                    visiting.push_back(w);
+                    root[w] = true;
+                    rindex[w] = index++;
+                    continue;
+                }
+                nextEdge[v]++;
+                if (rindex[w] < rindex[v])
+				{
+                    rindex[v] = rindex[w];
+                    root[v] = false;
+                }
+                continue;
+            }
+
+            // Finish v
+            visiting.pop_back();
+            if (root[v])
+			{
+                index--;
+                while (!S.empty() && rindex[v] <= rindex[S.back()])
+				{
+                    rindex[S.back()] = c;
+                    S.pop_back();
+                    index--;
+                }
+                rindex[v] = c;
+                c--;
+            }
+            else
+			{
+                S.push_back(v);
+            }
+
+            // Finish the edge from the parent of v
+            if (!visiting.empty())
+			{
+                int p = visiting.back();
+                nextEdge[p]++;
+                if (rindex[v] < rindex[p])
+				{
+                    rindex[p] = rindex[v];
+                    root[p] = false;
+                }
+            }
         }
-        V = nextIt;
-        if (debug) std::cerr << " * Current V (After): " << *V << std::endl;
-        if (debug) std::cerr << " * Current nextIt (After): " << *nextIt << std::endl;
     }
 
-    if (debug)
-    {
-        std::cerr << ">> Printing active vertices" << std::endl;
-        for (V = activeVertices.begin(); V != activeVertices.end(); V++) 
-        {
-            std::cerr << *V << std::endl;
+    // Merge every component into its first vertex
+    std::vector<int> representative(n + 1, -1);
+    int collapsed = 0;
+    for (int i = 0; i < n; i++)
+	{
+        int &rep = representative[rindex[i]];
+        if (rep == -1)
+		{
+            rep = ids[i];
+            continue;
         }
+        merge(ids[i], rep);
+        if (targets) targets->insert(rep);
+        collapsed++;
     }
 
+    if (debug) std::cerr << "Cycle sweep collapsed " << collapsed << " vertices" << std::endl;
+    sweeps.push_back(collapsed);
+    return collapsed;
 }
 
 // ============================================= //
 
-void PointerAnalysis::visit(int Node, IntMap& Order, IntMap& Repr,
-	int& idxOrder, IntSet& Curr, IntDeque& Stack)
+/**
+ * Get the representative of a vertex, compressing the path to it.
+ */
+int PointerAnalysis::find(int id)
 {
-    if (debug) std::cerr << "  - Visiting vertex " << Node << std::endl;
-
-	idxOrder++;
-    Order[Node] = idxOrder;
+    IntMap::iterator it = vertices.find(id);
+    if (it == vertices.end()) return id;
 
-    IntSet::iterator w;
-    for (w = from[Node].begin(); w != from[Node].end(); w++)
+    int root = id;
+    while (vertices[root] != root) root = vertices[root];
+    while (id != root)
 	{
-        if (Order[*w] == 0) visit(*w, Order, Repr, idxOrder, Curr, Stack);
-        if (Curr.find(*w) == Curr.end())
-		{
-            Repr[Node] = (Order[Repr[Node]] < Order[Repr[*w]]) ?
-                Repr[Node] :
-                Repr[*w]
-            ;
-        }
+        int next = vertices[id];
+        vertices[id] = root;
+        id = next;
     }
+    return root;
+}
 
-    if (Repr[Node] == Node)
-	{
-        Curr.insert(Node);
-        while (!Stack.empty())
-		{
-            int w = Stack.front();
-            if (Order[w] <= Order[Node]) break;
-            else
-			{
-                Stack.pop_front();
-                Curr.insert(w);
-                Repr[w] = Node;
-            }
-        }
-        // Push(TopologicalOrder, Node)
-    }
-    else
-	{
-        Stack.push_front(Node);
-    }
+// ============================================= //
+
+void PointerAnalysis::setCycleSweepPeriod(unsigned steps)
+{
+    sweepPeriod = steps;
+}
+
+// ============================================= //
+
+const std::vector<int>& PointerAnalysis::getCycleSweeps() const
+{
+    return sweeps;
+}
+
+// ============================================= //
+
+void PointerAnalysis::setTypeFilter(bool enabled)
+{
+    typeFilter = enabled;
+}
+
+// ============================================= //
+
+void PointerAnalysis::setNodeType(int id, int type)
+{
+    if (type) nodeTypes[id] = type;
+    else nodeTypes.erase(id);
+}
+
+// ============================================= //
+
+void PointerAnalysis::addTypePrefix(int type, int prefix)
+{
+    if (!type || !prefix || type == prefix) return;
+
+    IntSet &prefixes = typePrefixes[type];
+    prefixes.insert(prefix);
+
+    IntSetMap::iterator inner = typePrefixes.find(prefix);
+    if (inner != typePrefixes.end()) prefixes.insert(inner->second.begin(), inner->second.end());
+}
+
+// ============================================= //
+
+int PointerAnalysis::getNumFilteredEdges()
+{
+    return numFiltered;
+}
+
+// ============================================= //
+
+/**
+ * Whether the nodes a and b may hold the same values: same type, one of
+ * them untyped, or one type found at the start of the other.
+ */
+bool PointerAnalysis::typesCompatible(int a, int b)
+{
+    if (!typeFilter) return true;
+
+    IntMap::iterator typeA = nodeTypes.find(a);
+    IntMap::iterator typeB = nodeTypes.find(b);
+    if (typeA == nodeTypes.end() || typeB == nodeTypes.end()) return true;
+
+    int ta = typeA->second;
+    int tb = typeB->second;
+    if (ta == tb) return true;
+
+    IntSetMap::iterator prefixes = typePrefixes.find(ta);
+    if (prefixes != typePrefixes.end() && prefixes->second.count(tb)) return true;
+    prefixes = typePrefixes.find(tb);
+    if (prefixes != typePrefixes.end() && prefixes->second.count(ta)) return true;
+
+    numFiltered++;
+    return false;
 }
 
 // ============================================= //
@@ -407,10 +534,7 @@ void PointerAnalysis::merge(int id, int target)
 
     // Join Points-To set
     if (debug) std::cerr << "Points-to-set..." << std::endl;
-    for (v = pointsToSet[id].begin(); v != pointsToSet[id].end(); v++)
-	{
-        pointsToSet[target].insert(*v);
-    }
+    unionWith(pointsToSet[target], pointsToSet[id]);
     if (debug) std::cerr << "End of merging..." << std::endl;
 
 	// Count this merge
@@ -427,7 +551,7 @@ bool PointerAnalysis::comparePts(int a, int b) {
 	IntSet::iterator V;
 	for (V = pointsToSet[a].begin(); V != pointsToSet[a].end(); V++) 
 	{
-		if (pointsToSet[b].find(vertices[*V]) == pointsToSet[b].end()) 
+		if (pointsToSet[b].find(find(*V)) == pointsToSet[b].end()) 
 			return false;
 	}
 	return true;
@@ -439,19 +563,51 @@ bool PointerAnalysis::comparePts(int a, int b) {
  * Execute the pointer analysis
  * TODO: Add info about the analysis
  */
-void PointerAnalysis::solve(bool withCycleRemoval)
+void PointerAnalysis::solve(bool withCycleRemoval, llvm::CompileBudget *budget)
 {
 	numMerged = 0;
 	numCallsRemove = 0;
     std::set<std::string> R;
     IntSet WorkSet = activeVertices;
     IntSet NewWorkSet;
+    unsigned steps = 0;
+    double unificationFactor = 1.0;
+
+    // The budget may turn the sweeps off for this run only
+    unsigned period = sweepPeriod;
 
     if (debug) std::cerr << "Starting the analysis" << std::endl;
 
+    sweeps.clear();
+    if (period) removeCycles();
+
     while (!WorkSet.empty()) {
+        ++steps;
+
+        // Collapsing the cycles joins points-to sets, so the representatives
+        // have to be visited again
+        if (period && steps % period == 0) {
+            removeCycles(&NewWorkSet);
+        }
+
+        // Checking the budget is not free, so only do it once in a while
+        if (budget && (steps & 127) == 0) {
+            // The first overrun drops both kinds of cycle collapsing, and
+            // gives the analysis as long again before it falls back
+            if (unificationFactor == 1.0 && budget->exceeded()) {
+                budget->degrade("pointer analysis without cycle removal");
+                withCycleRemoval = false;
+                period = 0;
+                unificationFactor = 2.0;
+            } else if (unificationFactor > 1.0 && budget->exceeded(unificationFactor)) {
+                budget->degrade("unification-based pointer analysis");
+                solveByUnification();
+                return;
+            }
+        }
+
         int Node = *WorkSet.begin();
-        Node = vertices[Node];
+        Node = find(Node);
         WorkSet.erase(WorkSet.begin());
 
         if (debug)
@@ -464,7 +620,7 @@ void PointerAnalysis::solve(bool withCycleRemoval)
         IntSet::iterator V;
         for (V = pointsToSet[Node].begin(); V != pointsToSet[Node].end(); V++ )
 		{
-            int reprV = vertices[*V];
+            int reprV = find(*V);
             if (debug)
             {
                 std::cerr << "   - Current V: " << *V << std::endl;
@@ -477,7 +633,8 @@ void PointerAnalysis::solve(bool withCycleRemoval)
             {
                 // If V->A not in Graph
                 // Get the repr of A
-                int reprA = vertices[*A];
+                int reprA = find(*A);
+                if (!typesCompatible(*V, *A)) continue;
                 if (from[reprV].find(reprA) == from[reprV].end()) 
 				{
                     addEdge(reprV, reprA);
@@ -492,7 +649,8 @@ void PointerAnalysis::solve(bool withCycleRemoval)
             {
                 // If B->V not in Graph
                 // Get the repr of B
-                int reprB = vertices[*B];
+                int reprB = find(*B);
+                if (!typesCompatible(*V, *B)) continue;
                 if (from[reprB].find(reprV) == from[reprB].end()) 
 				{
                     addEdge(reprB, reprV);
@@ -509,8 +667,8 @@ void PointerAnalysis::solve(bool withCycleRemoval)
             IntSet::iterator NextZ = Z;
             NextZ++;
             int ZVal = *Z;
-			int repN = vertices[Node];
-			int repZ = vertices[ZVal];
+			int repN = find(Node);
+			int repZ = find(ZVal);
             std::stringstream sstm;
             sstm << repN << "->" << repZ;
             std::string edge = sstm.str();
@@ -544,11 +702,7 @@ void PointerAnalysis::solve(bool withCycleRemoval)
 
             // Merge the points-To Set
             if (debug) std::cerr << " - Merging pts" << std::endl;
-            bool changed = false;
-            for (V = pointsToSet[Node].begin(); V != pointsToSet[Node].end(); V++)
-			{
-                changed |= pointsToSet[ZVal].insert(*V).second;
-            }
+            bool changed = unionWith(pointsToSet[ZVal], pointsToSet[Node]);
 
             // Add Z to WorkSet if pointsToSet(Z) changed
             if (changed)
@@ -571,13 +725,129 @@ void PointerAnalysis::solve(bool withCycleRemoval)
         // Only have to consolidate if vertex is not active (was merged)
         // (in other words, when its repr. is not itself)
         if (NodeIt->first != NodeIt->second) {
-            const IntSet& ptsR = pointsToSet[NodeIt->second];
-            IntSet::iterator V;
-            for (V = ptsR.begin(); V != ptsR.end(); V++) {
-                pointsToSet[NodeIt->first].insert(*V);
-            }
+            const IntSet& ptsR = pointsToSet[find(NodeIt->second)];
+            unionWith(pointsToSet[NodeIt->first], ptsR);
+        }
+    }
+}
+
+// ============================================= //
+
+// Union-find helpers for the unification fallback
+static int findClass(IntMap& parent, int x)
+{
+    int root = x;
+    while (parent.count(root) && parent[root] != root) root = parent[root];
+    while (x != root) {
+        int next = parent[x];
+        parent[x] = root;
+        x = next;
+    }
+    return root;
+}
+
+static void joinClasses(IntMap& parent, IntMap& pointee, int a, int b)
+{
+    std::deque< std::pair<int, int> > pending;
+    pending.push_back(std::make_pair(a, b));
+
+    while (!pending.empty()) {
+        int x = findClass(parent, pending.front().first);
+        int y = findClass(parent, pending.front().second);
+        pending.pop_front();
+        if (x == y) continue;
+
+        // Unifying two classes unifies what they point to
+        parent[y] = x;
+        IntMap::iterator py = pointee.find(y);
+        if (py != pointee.end()) {
+            IntMap::iterator px = pointee.find(x);
+            if (px != pointee.end()) pending.push_back(std::make_pair(px->second, py->second));
+            else pointee[x] = py->second;
+            pointee.erase(y);
+        }
+    }
+}
+
+static int pointeeClass(IntMap& parent, IntMap& pointee, int x, int& fresh)
+{
+    x = findClass(parent, x);
+    IntMap::iterator p = pointee.find(x);
+    if (p == pointee.end()) {
+        // Fresh ids are negative, so they never clash with real nodes
+        pointee[x] = fresh;
+        parent[fresh] = fresh;
+        return fresh--;
+    }
+    return findClass(parent, p->second);
+}
+
+/**
+ * Steensgaard-style fallback used when the budget is exhausted. It unifies
+ * over the current state of the constraint graph, which only holds facts
+ * implied by the original constraints, so the result is a sound
+ * over-approximation of the inclusion-based one.
+ */
+void PointerAnalysis::solveByUnification()
+{
+    IntMap parent;
+    IntMap pointee;
+    int fresh = -1;
+    IntSet objects;
+
+    // Merged vertices share their points-to sets
+    for (IntMap::iterator v = vertices.begin(); v != vertices.end(); v++) {
+        joinClasses(parent, pointee, v->second, v->first);
+    }
+
+    // A = &B
+    for (IntSetMap::iterator A = pointsToSet.begin(); A != pointsToSet.end(); A++) {
+        for (IntSet::iterator B = A->second.begin(); B != A->second.end(); B++) {
+            joinClasses(parent, pointee, pointeeClass(parent, pointee, A->first, fresh), *B);
+            objects.insert(*B);
+        }
+    }
+
+    // B = A
+    for (IntSetMap::iterator A = from.begin(); A != from.end(); A++) {
+        for (IntSet::iterator B = A->second.begin(); B != A->second.end(); B++) {
+            joinClasses(parent, pointee, pointeeClass(parent, pointee, A->first, fresh),
+                        pointeeClass(parent, pointee, *B, fresh));
+        }
+    }
+
+    // A = *B
+    for (IntSetMap::iterator B = loads.begin(); B != loads.end(); B++) {
+        for (IntSet::iterator A = B->second.begin(); A != B->second.end(); A++) {
+            int pB = pointeeClass(parent, pointee, B->first, fresh);
+            joinClasses(parent, pointee, pointeeClass(parent, pointee, *A, fresh),
+                        pointeeClass(parent, pointee, pB, fresh));
         }
     }
+
+    // *A = B
+    for (IntSetMap::iterator A = stores.begin(); A != stores.end(); A++) {
+        for (IntSet::iterator B = A->second.begin(); B != A->second.end(); B++) {
+            int pA = pointeeClass(parent, pointee, A->first, fresh);
+            joinClasses(parent, pointee, pointeeClass(parent, pointee, pA, fresh),
+                        pointeeClass(parent, pointee, *B, fresh));
+        }
+    }
+
+    // The objects of each class
+    IntSetMap classObjects;
+    for (IntSet::iterator O = objects.begin(); O != objects.end(); O++) {
+        classObjects[findClass(parent, *O)].insert(*O);
+    }
+
+    // Everything in a class points to every object of its pointee class
+    pointsToSet.clear();
+    for (IntMap::iterator v = vertices.begin(); v != vertices.end(); v++) {
+        IntMap::iterator p = pointee.find(findClass(parent, v->first));
+        if (p == pointee.end()) continue;
+        IntSetMap::iterator objs = classObjects.find(findClass(parent, p->second));
+        if (objs != classObjects.end()) pointsToSet[v->first] = objs->second;
+    }
 }
 
 // ============================================= //
@@ -733,7 +1003,11 @@ void PointerAnalysis::printDot(std::ostream& output, std::string graphName,
 
 /// Returns the points-to map
 std::map<int, std::set<int> > PointerAnalysis::allPointsTo() {
-    return pointsToSet;
+    std::map<int, std::set<int> > result;
+    for (IntSetMap::iterator A = pointsToSet.begin(); A != pointsToSet.end(); A++) {
+        result[A->first].insert(A->second.begin(), A->second.end());
+    }
+    return result;
 }
 
 // ============================================= //
@@ -6,13 +6,21 @@
 #include <set>
 #include <map>
 #include <deque>
+#include <vector>
 #include <ostream>
 
+#include "SolverArena.h"
+
 // ============================================= //
 
-typedef std::set<int> IntSet;
-typedef std::map<int, IntSet> IntSetMap;
-typedef std::map<int, int> IntMap;
+namespace llvm {
+    class CompileBudget;
+}
+
+// The solver state lives in the solver arena
+typedef std::set<int, std::less<int>, ArenaAllocator<int> > IntSet;
+typedef std::map<int, IntSet, std::less<int>, ArenaAllocator<std::pair<const int, IntSet> > > IntSetMap;
+typedef std::map<int, int, std::less<int>, ArenaAllocator<std::pair<const int, int> > > IntMap;
 typedef std::deque<int> IntDeque;
 
 // ============================================= //
@@ -35,8 +43,33 @@ class PointerAnalysis {
         // Add a constraint of type: A = *B
         void addLoad(int A, int B);
 
-        // Execute the pointer analysis
-        void solve(bool withCycleRemoval = true);
+        // Execute the pointer analysis. When a budget is given and it is
+        // exceeded, cycle removal and the periodic cycle sweeps are dropped,
+        // and if twice the budget is exceeded the analysis falls back to
+        // unification.
+        void solve(bool withCycleRemoval = true, llvm::CompileBudget *budget = 0);
+
+        // Collapse every cycle of the graph once every given number of
+        // solver steps, and once before solving (0: never)
+        void setCycleSweepPeriod(unsigned steps);
+
+        // Number of vertices collapsed by each cycle sweep
+        const std::vector<int>& getCycleSweeps() const;
+
+        // Type filtering: loads and stores only connect a memory position
+        // to a value of a compatible type. Types are numbers, 0 being
+        // compatible with everything, and nodes without a type have type 0.
+        void setTypeFilter(bool enabled);
+
+        // The type of a value, or of what a memory position holds
+        void setNodeType(int id, int type);
+
+        // A value of type prefix, or of any type found at its start, may
+        // be found at the start of one of type, so they are compatible
+        void addTypePrefix(int type, int prefix);
+
+        // Number of times the type filter dropped a load or store edge
+        int getNumFilteredEdges();
 
         // Return the set of positions pointed by A:
         //   pointsTo(A) = {B1, B2, ...}
@@ -66,9 +99,13 @@ class PointerAnalysis {
 		bool comparePts(int a, int b);
 		void cycleSearch(int source, int target);
 		void merge(int id, int target);
-		void visit(int Node, IntMap& Order, IntMap& Repr, int& idxOrder,
-			IntSet& Curr, IntDeque& Stack);
-        void removeCycles();
+		int find(int id);
+		bool typesCompatible(int a, int b);
+        int removeCycles(IntSet *targets = 0);
+        void solveByUnification();
+
+		// Must come before every container, which it outlives
+		SolverArena::User arenaUser;
 
 		// Hold the points-to Set
 		IntSetMap pointsToSet;
@@ -78,6 +115,16 @@ class PointerAnalysis {
 		int numMerged;
 		int numCallsRemove;
 
+		// Cycle sweeps
+		unsigned sweepPeriod;
+		std::vector<int> sweeps;
+
+		// Type filtering
+		bool typeFilter;
+		int numFiltered;
+		IntMap nodeTypes;
+		IntSetMap typePrefixes;
+
 		// Hold the active vertices
 		IntSet activeVertices;
 
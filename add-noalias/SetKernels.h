@@ -0,0 +1,69 @@
+//   Operations on ordered points-to sets
+
+#ifndef SET_KERNELS_H
+#define SET_KERNELS_H
+
+#include <cstddef>
+
+// ============================================= //
+
+// Add every element of src to dst and return whether dst changed. Large
+// sets of similar sizes are walked side by side, so elements dst already
+// has cost no lookup and new ones are inserted where they go; otherwise
+// each element of src is looked up in dst.
+template <typename DstSet, typename SrcSet>
+bool unionWith(DstSet &dst, const SrcSet &src)
+{
+    bool changed = false;
+
+    if (src.size() < 64 || dst.size() > src.size() * 16) {
+        for (typename SrcSet::const_iterator s = src.begin(); s != src.end(); ++s) {
+            changed |= dst.insert(*s).second;
+        }
+        return changed;
+    }
+
+    typename DstSet::iterator d = dst.begin();
+    for (typename SrcSet::const_iterator s = src.begin(); s != src.end(); ++s) {
+        while (d != dst.end() && *d < *s) ++d;
+        if (d != dst.end() && !(*s < *d)) {
+            ++d;
+            continue;
+        }
+        dst.insert(d, *s);
+        changed = true;
+    }
+    return changed;
+}
+
+// ============================================= //
+
+// Whether a and b have an element in common. Stops at the first one, and
+// looks the smaller set up in the larger one when their sizes differ a lot.
+template <typename SetA, typename SetB>
+bool intersects(const SetA &a, const SetB &b)
+{
+    if (a.empty() || b.empty()) return false;
+    if (*a.rbegin() < *b.begin() || *b.rbegin() < *a.begin()) return false;
+
+    if (a.size() * 16 < b.size()) {
+        for (typename SetA::const_iterator i = a.begin(); i != a.end(); ++i) {
+            if (b.count(*i)) return true;
+        }
+        return false;
+    }
+    if (b.size() * 16 < a.size()) return intersects(b, a);
+
+    typename SetA::const_iterator i = a.begin();
+    typename SetB::const_iterator j = b.begin();
+    while (i != a.end() && j != b.end()) {
+        if (*i < *j) ++i;
+        else if (*j < *i) ++j;
+        else return true;
+    }
+    return false;
+}
+
+// ============================================= //
+
+#endif  /* SET_KERNELS_H */
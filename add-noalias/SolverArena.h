@@ -0,0 +1,166 @@
+//   Memory for the pointer analysis solver
+
+#ifndef SOLVER_ARENA_H
+#define SOLVER_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// ============================================= //
+
+// Hands out the nodes of the solver sets and maps from large chunks. Freed
+// nodes go to a free list for their size and are reused; the chunks are
+// only given back, all at once, when the last solver using the arena is
+// destroyed, so tearing down a large constraint graph does not free its
+// nodes one by one.
+class SolverArena {
+
+    public:
+        // Keeps the arena alive while its holder exists. Declare it before
+        // every container that uses the arena, so it is destroyed after them.
+        class User {
+            public:
+                User() { SolverArena::get().users++; }
+                ~User() {
+                    SolverArena &arena = SolverArena::get();
+                    if (--arena.users == 0) arena.release();
+                }
+
+            private:
+                User(const User&);
+                User& operator=(const User&);
+        };
+
+        static SolverArena& get() {
+            static SolverArena arena;
+            return arena;
+        }
+
+        void* allocate(size_t size) {
+            size = roundUp(size);
+            if (size > MaxNodeSize) return ::operator new(size);
+
+            FreeNode *&head = freeLists[size / Alignment];
+            if (head) {
+                FreeNode *node = head;
+                head = node->next;
+                return node;
+            }
+
+            if (size > size_t(end - cur)) newChunk();
+            void *p = cur;
+            cur += size;
+            return p;
+        }
+
+        void deallocate(void *p, size_t size) {
+            size = roundUp(size);
+            if (size > MaxNodeSize) {
+                ::operator delete(p);
+                return;
+            }
+
+            FreeNode *node = static_cast<FreeNode*>(p);
+            node->next = freeLists[size / Alignment];
+            freeLists[size / Alignment] = node;
+        }
+
+        // Bytes taken from the system
+        size_t getBytesReserved() const {
+            return chunks.size() * ChunkSize;
+        }
+
+    private:
+        static const size_t Alignment = sizeof(void*) > 8 ? sizeof(void*) : 8;
+        static const size_t MaxNodeSize = 32 * Alignment;
+        static const size_t ChunkSize = 256 * 1024;
+
+        struct FreeNode {
+            FreeNode *next;
+        };
+
+        std::vector<char*> chunks;
+        char *cur;
+        char *end;
+        FreeNode *freeLists[MaxNodeSize / Alignment + 1];
+        unsigned users;
+
+        SolverArena() : cur(0), end(0), users(0) {
+            for (size_t i = 0; i <= MaxNodeSize / Alignment; i++) freeLists[i] = 0;
+        }
+
+        ~SolverArena() {
+            release();
+        }
+
+        SolverArena(const SolverArena&);
+        SolverArena& operator=(const SolverArena&);
+
+        static size_t roundUp(size_t size) {
+            return (size + Alignment - 1) / Alignment * Alignment;
+        }
+
+        void newChunk() {
+            chunks.push_back(static_cast<char*>(::operator new(ChunkSize)));
+            cur = chunks.back();
+            end = cur + ChunkSize;
+        }
+
+        // Give every chunk back
+        void release() {
+            for (size_t i = 0; i < chunks.size(); i++) ::operator delete(chunks[i]);
+            std::vector<char*>().swap(chunks);
+            cur = end = 0;
+            for (size_t i = 0; i <= MaxNodeSize / Alignment; i++) freeLists[i] = 0;
+        }
+};
+
+// ============================================= //
+
+// Standard allocator over the solver arena
+template <typename T>
+class ArenaAllocator {
+
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+
+        template <typename U> struct rebind {
+            typedef ArenaAllocator<U> other;
+        };
+
+        ArenaAllocator() {}
+        template <typename U> ArenaAllocator(const ArenaAllocator<U>&) {}
+
+        pointer address(reference x) const { return &x; }
+        const_pointer address(const_reference x) const { return &x; }
+
+        pointer allocate(size_type n, const void* = 0) {
+            return static_cast<pointer>(SolverArena::get().allocate(n * sizeof(T)));
+        }
+
+        void deallocate(pointer p, size_type n) {
+            SolverArena::get().deallocate(p, n * sizeof(T));
+        }
+
+        size_type max_size() const { return size_t(-1) / sizeof(T); }
+
+        void construct(pointer p, const T& v) { new (p) T(v); }
+        void destroy(pointer p) { p->~T(); }
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&) { return false; }
+
+// ============================================= //
+
+#endif  /* SOLVER_ARENA_H */
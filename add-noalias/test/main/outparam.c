@@ -0,0 +1,17 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void make(char **out);
+
+int main() {
+  char *p;
+  char pad[256];
+
+  make(&p);
+  // Overwrite the frame make ran in
+  memset(pad, 'x', sizeof pad);
+  printf("%s %c\n", p, pad[0]);
+  free(p);
+  return 0;
+}
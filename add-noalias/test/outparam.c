@@ -0,0 +1,10 @@
+#include <stdlib.h>
+#include <string.h>
+
+// Only main/outparam.c calls make, so this module sees no caller. The block
+// reaches the caller through out and must stay on the heap.
+void make(char **out) {
+  char *p = malloc(16);
+  strcpy(p, "heap");
+  *out = p;
+}
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# Each test is a module compiled through the pass and linked with its driver
+# in main/, which the pass never sees.
+
+BIN=$1
+PASS=$2
+LIB=$3
+OUT='output'
+
+rm -rf $OUT
+mkdir $OUT
+
+for BENCH in *.c
+do
+  BASE=`basename $BENCH .c`
+  echo $BASE
+
+  BENCH_BASE=$OUT/$BASE.baseline
+  BENCH_PASS=$OUT/$BASE.$PASS
+
+  # generate bytecode
+  $BIN/clang -w -emit-llvm -S -c $BENCH -o $BENCH_BASE.bc
+  $BIN/opt -load $LIB -$PASS $BENCH_BASE.bc -S > $BENCH_PASS.bc
+
+  # create binaries
+  $BIN/clang $BENCH_BASE.bc main/$BENCH -o $BENCH_BASE
+  $BIN/clang $BENCH_PASS.bc main/$BENCH -o $BENCH_PASS
+
+  # run original and transformed, which must agree
+  ./$BENCH_BASE > $BENCH_BASE.out
+  ./$BENCH_PASS > $BENCH_PASS.out
+
+  if cmp -s $BENCH_BASE.out $BENCH_PASS.out
+  then
+    echo "ok"
+  else
+    echo "FAIL: "`cat $BENCH_PASS.out`
+  fi
+  echo
+done
@@ -0,0 +1,86 @@
+#ifndef CBO_ARGUMENT_USES_H
+#define CBO_ARGUMENT_USES_H
+
+#include <set>
+#include <vector>
+
+#include "llvm/IR/Argument.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace llvm {
+
+  // The loads that read back what SI stores, when SI spills a value to a
+  // stack slot of the entry block that nothing else writes or lets escape,
+  // as clang does with every argument at -O0. False when SI is no such
+  // spill.
+  inline bool getSpillReloads(StoreInst *SI, SmallVectorImpl<LoadInst*> &reloads) {
+    AllocaInst *AI = dyn_cast<AllocaInst>(SI->getPointerOperand());
+    BasicBlock *entry = &SI->getParent()->getParent()->getEntryBlock();
+    if (!AI || AI->isArrayAllocation() || !SI->isSimple() || SI->getValueOperand() == AI) return false;
+    if (SI->getParent() != entry) return false;
+
+    SmallVector<LoadInst*, 8> loads;
+    for (Value::use_iterator UI = AI->use_begin(), E = AI->use_end(); UI != E; ++UI) {
+      if (*UI == SI) continue;
+      LoadInst *LI = dyn_cast<LoadInst>(*UI);
+      if (!LI || !LI->isSimple()) return false;
+      loads.push_back(LI);
+    }
+
+    // Loads before the spill read something else
+    for (BasicBlock::iterator I = entry->begin(); &*I != SI; ++I) {
+      LoadInst *LI = dyn_cast<LoadInst>(I);
+      if (LI && LI->getPointerOperand() == AI) return false;
+    }
+
+    reloads.append(loads.begin(), loads.end());
+    return true;
+  }
+
+  // Walks the uses of an argument and of the values the client computes
+  // from it. Spills are walked through to the loads that read them back, so
+  // the walk is the same at -O0 as after mem2reg.
+  class ArgumentUseWalker {
+    std::vector<Use*> pending;
+    std::set<Value*> visited;
+
+   public:
+    explicit ArgumentUseWalker(Argument *A) { follow(A); }
+
+    // Also walk the uses of V
+    void follow(Value *V) {
+      if (!visited.insert(V).second) return;
+      for (Value::use_iterator UI = V->use_begin(), E = V->use_end(); UI != E; ++UI) {
+        pending.push_back(&UI.getUse());
+      }
+    }
+
+    // The next use, or 0 when the walk is over
+    Use *next() {
+      while (!pending.empty()) {
+        Use *U = pending.back();
+        pending.pop_back();
+
+        StoreInst *SI = dyn_cast<StoreInst>(U->getUser());
+        SmallVector<LoadInst*, 8> reloads;
+        if (SI && U->getOperandNo() == 0 && getSpillReloads(SI, reloads)) {
+          for (unsigned i = 0; i < reloads.size(); ++i) follow(reloads[i]);
+          continue;
+        }
+        return U;
+      }
+      return 0;
+    }
+  };
+
+  // Whether U is the callee operand of the call or invoke CS
+  inline bool isCalleeUse(CallSite CS, Use *U) {
+    return U->get() == CS.getCalledValue() && (U < CS.arg_begin() || U >= CS.arg_end());
+  }
+}
+
+#endif
@@ -2,17 +2,74 @@
 
 using namespace llvm;
 
-CloneConstantArgs::CloneConstantArgs() : ModulePass(ID) {
+static cl::opt<unsigned>
+ConstArgsTimeBudget("clone-constant-args-time-budget", cl::init(0),
+                    cl::desc("Seconds clone-constant-args may take before it stops cloning (0: no limit)"));
+
+static cl::opt<unsigned>
+ConstArgsMemoryBudget("clone-constant-args-memory-budget", cl::init(0),
+                      cl::desc("Megabytes clone-constant-args may use before it stops cloning (0: no limit)"));
+
+static cl::opt<double>
+ConstArgsMinScore("clone-constant-args-min-score", cl::init(1.0),
+                  cl::desc("Score a constant argument needs to be specialized (0: specialize every constant)"));
+
+static cl::opt<unsigned>
+ConstArgsEvalSteps("clone-constant-args-eval-steps", cl::init(100000),
+                   cl::desc("Instructions clone-constant-args may run to compute the result of a call (0: never)"));
+
+static cl::opt<unsigned>
+ConstArgsEvalDepth("clone-constant-args-eval-depth", cl::init(64),
+                   cl::desc("Nested calls clone-constant-args may run to compute the result of a call"));
+
+static cl::opt<double>
+ConstArgsColdRatio("clone-constant-args-cold-ratio", cl::init(0),
+                   cl::desc("Share the regions of a function that run less than this ratio of its calls between it and its clones (0: clone whole functions)"));
+
+static cl::opt<std::string>
+ConstArgsValueProfile("clone-constant-args-value-profile", cl::init(""),
+                      cl::desc("Value profile of the value-profiler run time, to clone for arguments that nearly always take one value"));
+
+static cl::opt<double>
+ConstArgsValueRatio("clone-constant-args-value-ratio", cl::init(0.9),
+                    cl::desc("Fraction of the calls a profiled value must be passed in to be specialized"));
+
+static cl::opt<unsigned>
+ConstArgsValueMinCalls("clone-constant-args-value-min-calls", cl::init(1000),
+                       cl::desc("Calls a profiled function must have had for its values to be specialized"));
+
+// What a constant decides, by kind of use
+static const double BranchWeight       = 1.0;
+static const double SwitchWeight       = 2.0;
+static const double LoopBoundWeight    = 4.0;
+static const double DivisorWeight      = 2.0;
+static const double IndexWeight        = 0.5;
+static const double IndirectCallWeight = 4.0;
+
+void CloneConstantArgs::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<BlockFrequencyInfo>();
+  AU.addRequired<DominatorTree>();
+  AU.addRequired<LoopInfo>();
+}
+
+CloneConstantArgs::CloneConstantArgs() : ModulePass(ID), budget("clone-constant-args") {
   FunctionsCount    = 0;
   FunctionsCloned   = 0;
   ClonesCount       = 0;
   CallsCount        = 0;
   PromissorCalls    = 0;
   CallsReplaced     = 0;
+  EvaluatedCalls    = 0;
+  WorthlessArgs     = 0;
+  FoldedLoads       = 0;
+  GuardedCalls      = 0;
 }
 
 bool CloneConstantArgs::runOnModule(Module &M) {
+  budget.reset(ConstArgsTimeBudget, ConstArgsMemoryBudget);
+  TD = getAnalysisIfAvailable<DataLayout>();
 
+  if (!ConstArgsValueProfile.empty()) guardProfiledValues(M);
   findConstantArgs(M);
   collectFn2Clone();
   bool modified = cloneFunctions();
@@ -20,7 +77,146 @@ bool CloneConstantArgs::runOnModule(Module &M) {
   return modified;
 }
 
+// Test the arguments that the profile says nearly always take one value
+// against it, and pass the value as a constant on the path where the test
+// holds. The calls on that path are then cloned like any other call with a
+// constant argument.
+void CloneConstantArgs::guardProfiledValues(Module &M) {
+  std::map<Argument*, std::pair<int64_t, double> > hotValues;
+  readValueProfile(M, hotValues);
+
+  // Guard a single argument per function, the one worth the most, so calls
+  // are not split again for each of its arguments
+  std::map<Function*, Argument*> guarded;
+  for (std::map<Argument*, std::pair<int64_t, double> >::iterator it = hotValues.begin(); it != hotValues.end(); ++it) {
+    Argument *A = it->first;
+    double score = scoreArgument(A);
+    if (score < ConstArgsMinScore) continue;
+
+    Argument *&best = guarded[A->getParent()];
+    if (!best || scoreArgument(best) < score) best = A;
+  }
+
+  for (std::map<Function*, Argument*>::iterator it = guarded.begin(); it != guarded.end(); ++it) {
+    Function *F = it->first;
+    Argument *A = it->second;
+    std::pair<int64_t, double> hot = hotValues[A];
+
+    std::vector<CallInst*> calls;
+    for (Value::use_iterator UI = F->use_begin(), E = F->use_end(); UI != E; ++UI) {
+      CallInst *CI = dyn_cast<CallInst>(*UI);
+      if (!CI || CI->getCalledFunction() != F || CI->getNumArgOperands() != F->arg_size()) continue;
+      if (isa<Constant>(CI->getArgOperand(A->getArgNo())) || isColdCall(CI)) continue;
+      calls.push_back(CI);
+    }
+    if (calls.empty()) continue;
+
+    ConstantInt *value = ConstantInt::getSigned(cast<IntegerType>(A->getType()), hot.first);
+    unsigned hotWeight = unsigned(hot.second * 1000);
+    MDNode *weights = MDBuilder(M.getContext()).createBranchWeights(hotWeight, std::max(1000 - hotWeight, 1u));
+
+    for (std::vector<CallInst*>::iterator CI = calls.begin(); CI != calls.end(); ++CI) {
+      guardCall(*CI, A, value, weights);
+    }
+  }
+}
+
+// Read the integer arguments that take one value in most of the calls to
+// their function. Lines for the same argument, from several runs, are summed.
+void CloneConstantArgs::readValueProfile(Module &M, std::map<Argument*, std::pair<int64_t, double> > &hotValues) {
+  std::ifstream in(ConstArgsValueProfile.c_str());
+  if (!in) {
+    errs() << "warning: clone-constant-args: cannot read value profile " << ConstArgsValueProfile << "\n";
+    return;
+  }
+
+  std::map<std::pair<std::string, unsigned>, uint64_t> totals;
+  std::map<std::pair<std::string, unsigned>, std::map<int64_t, uint64_t> > counts;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::pair<std::string, unsigned> site;
+    uint64_t total;
+    if (!(fields >> site.first >> site.second >> total)) continue;
+    totals[site] += total;
+
+    std::string entry;
+    while (fields >> entry) {
+      size_t colon = entry.find(':');
+      if (colon == std::string::npos) continue;
+      int64_t value = strtoll(entry.substr(0, colon).c_str(), 0, 10);
+      counts[site][value] += strtoull(entry.substr(colon + 1).c_str(), 0, 10);
+    }
+  }
+
+  // Internal functions are named after their module in the profile
+  std::map<std::string, Function*> functions;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!F->isDeclaration()) functions[getValueProfileName(*F)] = F;
+  }
+
+  for (std::map<std::pair<std::string, unsigned>, uint64_t>::iterator it = totals.begin(); it != totals.end(); ++it) {
+    Function *F = functions[it->first.first];
+    if (!F || it->first.second >= F->arg_size()) continue;
+    if (it->second < ConstArgsValueMinCalls) continue;
+
+    Function::arg_iterator A = F->arg_begin();
+    std::advance(A, it->first.second);
+    if (!A->getType()->isIntegerTy()) continue;
+
+    std::map<int64_t, uint64_t> &values = counts[it->first];
+    for (std::map<int64_t, uint64_t>::iterator V = values.begin(); V != values.end(); ++V) {
+      double ratio = double(V->second) / it->second;
+      if (ratio < ConstArgsValueRatio) continue;
+
+      DEBUG(errs() << F->getName() << ": argument " << A->getArgNo() << " is " << V->first << " in " << ratio << " of the calls\n");
+      hotValues[A] = std::make_pair(V->first, ratio);
+    }
+  }
+}
+
+// Replace CI by a test of its argument for A against hot, a call with hot
+// in its place if the test holds, and CI otherwise
+void CloneConstantArgs::guardCall(CallInst *CI, Argument *A, ConstantInt *hot, MDNode *weights) {
+  BasicBlock *BB = CI->getParent();
+  Function *Caller = BB->getParent();
+  LLVMContext &Ctx = Caller->getContext();
+
+  Value *actual = CI->getArgOperand(A->getArgNo());
+  if (actual->getType() != hot->getType()) return;
+
+  ICmpInst *test = new ICmpInst(CI, ICmpInst::ICMP_EQ, actual, hot, "hot");
+  BasicBlock *Tail = BB->splitBasicBlock(CI, BB->getName() + ".dispatch");
+
+  BasicBlock *Then = BasicBlock::Create(Ctx, "hot.call", Caller, Tail);
+  CallInst *NC = cast<CallInst>(CI->clone());
+  NC->setArgOperand(A->getArgNo(), hot);
+  Then->getInstList().push_back(NC);
+  BranchInst::Create(Tail, Then);
+
+  BasicBlock *Else = BasicBlock::Create(Ctx, "call", Caller, Tail);
+  CI->moveBefore(BranchInst::Create(Tail, Else));
+
+  BB->getTerminator()->eraseFromParent();
+  BranchInst::Create(Then, Else, test, BB)->setMetadata(LLVMContext::MD_prof, weights);
+
+  if (!CI->getType()->isVoidTy()) {
+    PHINode *PN = PHINode::Create(CI->getType(), 2, "", Tail->begin());
+    PN->takeName(CI);
+    CI->replaceAllUsesWith(PN);
+    PN->addIncoming(NC, Then);
+    PN->addIncoming(CI, Else);
+  }
+
+  GuardedCalls++;
+}
+
 void CloneConstantArgs::findConstantArgs(Module &M) {
+  // Calls whose arguments are all constant, which may be replaced by their
+  // result instead of cloning the callee
+  std::vector<CallInst*> constantCalls;
+
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (!F->isDeclaration()) {
       FunctionsCount++;
@@ -35,7 +231,7 @@ void CloneConstantArgs::findConstantArgs(Module &M) {
         if (!isa<CallInst>(U) && !isa<InvokeInst>(U)) continue;
 
         CallSite CS(cast<Instruction>(U));
-        if (!CS.isCallee(UI)) continue;
+        if (!CS.isCallee(UI) || isColdCall(CS)) continue;
 
         if(F->arg_empty()) break;
 
@@ -43,17 +239,117 @@ void CloneConstantArgs::findConstantArgs(Module &M) {
         CallSite::arg_iterator actualArgIter = CS.arg_begin();
         int size = F->arg_size();
 
+        bool allConstant = CS.arg_size() == F->arg_size();
+        for (CallSite::arg_iterator it = CS.arg_begin(), AE = CS.arg_end(); it != AE; ++it) {
+          allConstant = allConstant && isa<Constant>(*it);
+        }
+        if (allConstant && ConstArgsEvalSteps && isa<CallInst>(U)) {
+          constantCalls.push_back(cast<CallInst>(U));
+        }
+
         for (int i = 0; i < size; ++i, ++actualArgIter, ++formalArgIter) {
           Value *actualArg = *actualArgIter;
 
-          if (isa<Constant>(actualArg)) {
-            arguments[U].push_back(std::make_pair(formalArgIter, actualArg));
+          if (!isa<Constant>(actualArg)) continue;
+          if (scoreArgument(formalArgIter) < ConstArgsMinScore) {
+            WorthlessArgs++;
+            continue;
           }
+          arguments[U].push_back(std::make_pair(formalArgIter, actualArg));
         }
  
       }
     }
   }
+
+  evaluateConstantCalls(constantCalls);
+}
+
+// Replace the calls that can be run at compile time by their result, so
+// their callees need no clone for them
+void CloneConstantArgs::evaluateConstantCalls(std::vector<CallInst*> &calls) {
+  ConstantEvaluator evaluator(TD, ConstArgsEvalSteps, ConstArgsEvalDepth);
+
+  for (std::vector<CallInst*>::iterator it = calls.begin(); it != calls.end(); ++it) {
+    CallInst *CI = *it;
+
+    std::vector<Constant*> args;
+    for (unsigned i = 0, e = CI->getNumArgOperands(); i != e; ++i) {
+      args.push_back(cast<Constant>(CI->getArgOperand(i)));
+    }
+
+    Constant *result = evaluator.evaluate(CI->getCalledFunction(), args);
+    if (!result) continue;
+
+    DEBUG(errs() << "Evaluated " << *CI << " to " << *result << "\n");
+    arguments.erase(CI);
+    CI->replaceAllUsesWith(result);
+    CI->eraseFromParent();
+    EvaluatedCalls++;
+  }
+}
+
+double CloneConstantArgs::scoreArgument(Argument *A) {
+  if (!argScores.count(A)) scoreArguments(A->getParent());
+  return argScores[A];
+}
+
+// Score what a constant would unlock for each argument of F: the branches,
+// switches, loop exits, divisions, addresses and indirect calls it decides,
+// directly or through the values computed from it, each weighted by how
+// often it runs per call of F. Arguments spilled to the stack, as at -O0,
+// are followed through their reloads.
+void CloneConstantArgs::scoreArguments(Function *F) {
+  BlockFrequencyInfo &BFI = getAnalysis<BlockFrequencyInfo>(*F);
+  LoopInfo &LI = getAnalysis<LoopInfo>(*F);
+  double entry = BFI.getBlockFreq(&F->getEntryBlock()).getFrequency();
+  if (entry == 0) entry = 1;
+
+  for (Function::arg_iterator A = F->arg_begin(), AE = F->arg_end(); A != AE; ++A) {
+    double score = 0.0;
+    ArgumentUseWalker uses(A);
+
+    while (Use *U = uses.next()) {
+      Instruction *I = dyn_cast<Instruction>(U->getUser());
+      if (!I) continue;
+
+      double weight = 0.0;
+      if (isa<BranchInst>(I)) {
+        Loop *L = LI.getLoopFor(I->getParent());
+        weight = L && L->isLoopExiting(I->getParent()) ? LoopBoundWeight : BranchWeight;
+      } else if (isa<SwitchInst>(I)) {
+        weight = SwitchWeight;
+      } else if (BinaryOperator *BO = dyn_cast<BinaryOperator>(I)) {
+        switch (BO->getOpcode()) {
+          case Instruction::UDiv:
+          case Instruction::SDiv:
+          case Instruction::URem:
+          case Instruction::SRem:
+            if (U->getOperandNo() == 1) weight = DivisorWeight;
+            break;
+          default:
+            break;
+        }
+        uses.follow(I);
+      } else if (isa<GetElementPtrInst>(I)) {
+        if (U->getOperandNo() > 0) weight = IndexWeight;
+        uses.follow(I);
+      } else if (isa<CastInst>(I) || isa<CmpInst>(I) || isa<SelectInst>(I) ||
+                 isa<PHINode>(I) || isa<LoadInst>(I)) {
+        // Loads through a constant pointer may read a constant table
+        uses.follow(I);
+      } else if (isa<CallInst>(I) || isa<InvokeInst>(I)) {
+        if (isCalleeUse(CallSite(I), U)) weight = IndirectCallWeight;
+      }
+
+      if (weight > 0) {
+        score += weight * BFI.getBlockFreq(I->getParent()).getFrequency() / entry;
+      }
+    }
+
+    DEBUG(errs() << F->getName() << ": argument " << A->getArgNo() << " scores " << score << "\n");
+    argScores[A] = score;
+  }
 }
 
 void CloneConstantArgs::collectFn2Clone() {
@@ -96,13 +392,29 @@ bool CloneConstantArgs::cloneFunctions() {
       std::vector< std::pair<Argument*, Value*> > userArgs = arguments[caller];
 
       if (!clonedFns.count(userArgs)) {
-        // Clone function if a proper clone doesnt already exist
-        std::stringstream suffix;
-        suffix << ".constargs" << i;
-        Function* NF = cloneFunctionWithConstArgs(F, caller, suffix.str());
+        // Keep the clones made so far, but do not make new ones
+        if (budget.exceeded()) {
+          budget.degrade("stopped creating constant argument clones");
+          continue;
+        }
+
+        // Clone function if a proper clone doesnt already exist. Clones are
+        // named after what they specialize, so the same clone made in other
+        // modules gets the same name and is folded by the linker.
+        bool moduleIndependent;
+        std::string name = getCloneName(F->getName(), ".constargs", getSignature(userArgs, moduleIndependent));
+        Function* NF = F->getParent()->getFunction(name);
+        if (!NF || NF->getFunctionType() != F->getFunctionType()) {
+          if (ConstArgsColdRatio > 0) {
+            partial.outlineColdRegions(*F, getAnalysis<BlockFrequencyInfo>(*F),
+                                       getAnalysis<DominatorTree>(*F), ConstArgsColdRatio);
+          }
+          NF = cloneFunctionWithConstArgs(F, caller, name, getCloneLinkage(F, moduleIndependent));
+          if (ConstArgsColdRatio > 0) partial.recordClone(NF, F);
+          ClonesCount++;
+        }
         replaceCallingInst(caller, NF);
         clonedFns[userArgs] = NF;
-        ClonesCount++;
       } else {
         // Use existing clone
         Function* NF = clonedFns.at(userArgs);
@@ -126,12 +438,24 @@ void CloneConstantArgs::replaceCallingInst(User* caller, Function* fn) {
   }
 }
 
-// Clone the given function adding noalias attribute to arguments
-Function* CloneConstantArgs::cloneFunctionWithConstArgs(Function *Fn, User* caller, std::string suffix) {
+// Build the specialization signature of a clone from its constant args
+std::string CloneConstantArgs::getSignature(const std::vector< std::pair<Argument*, Value*> > &args, bool &moduleIndependent) {
+  std::string signature;
+  moduleIndependent = true;
+  for (std::vector< std::pair<Argument*, Value*> >::const_iterator it = args.begin(); it != args.end(); ++it) {
+    Constant *C = cast<Constant>(it->second);
+    appendConstantSignature(signature, it->first->getArgNo(), C, it->first->getParent()->getParent());
+    moduleIndependent = moduleIndependent && isModuleIndependent(C);
+  }
+  return signature;
+}
+
+// Clone the given function replacing the constant args
+Function* CloneConstantArgs::cloneFunctionWithConstArgs(Function *Fn, User* caller, std::string name, GlobalValue::LinkageTypes linkage) {
 
   // Start by computing a new prototype for the function, which is the
   // same as the old function
-  Function *NF = Function::Create(Fn->getFunctionType(), Fn->getLinkage());
+  Function *NF = Function::Create(Fn->getFunctionType(), linkage);
   NF->copyAttributesFrom(Fn);
 
   // After the parameters have been copied, we should copy the parameter
@@ -142,7 +466,7 @@ Function* CloneConstantArgs::cloneFunctionWithConstArgs(Function *Fn, User* call
   }
 
   // To avoid name collision, we should select another name.
-  NF->setName(Fn->getName() + suffix);
+  NF->setName(name);
 
   // fill clone content
   ValueToValueMapTy VMap;
@@ -162,15 +486,20 @@ Function* CloneConstantArgs::cloneFunctionWithConstArgs(Function *Fn, User* call
     argsMap[argPair.first] = argPair.second;
   }
 
+  std::vector<Instruction*> argUsers;
   Function::arg_iterator NFArgIter = NF->arg_begin();
   for (Function::arg_iterator FnArgIter = Fn->arg_begin();
       FnArgIter != Fn->arg_end(); ++FnArgIter, ++NFArgIter) {
     Value *formalArg = NFArgIter;
     if (argsMap.count(FnArgIter)) {
       Value *actualArg = argsMap[FnArgIter];
+      for (Value::use_iterator UI = formalArg->use_begin(), E = formalArg->use_end(); UI != E; ++UI) {
+        argUsers.push_back(cast<Instruction>(*UI));
+      }
       formalArg->replaceAllUsesWith(actualArg);
     }
   }
+  foldConstantLoads(NF, argUsers);
 
   // Insert the clone function before the original
   Fn->getParent()->getFunctionList().insert(Fn, NF);
@@ -178,9 +507,69 @@ Function* CloneConstantArgs::cloneFunctionWithConstArgs(Function *Fn, User* call
   return NF;
 }
 
+// Fold the loads from constant globals that the constant arguments of the
+// clone NF lead to, starting from the users of the arguments in worklist,
+// and everything that becomes constant with them: addresses into nested
+// tables, loop bounds and the branches on them. Arguments spilled to the
+// stack, as at -O0, are forwarded to their reloads.
+void CloneConstantArgs::foldConstantLoads(Function *NF, std::vector<Instruction*> worklist) {
+  SmallVector<WeakVH, 16> folded;
+
+  while (!worklist.empty()) {
+    Instruction *I = worklist.back();
+    worklist.pop_back();
+
+    // A constant spilled to the stack, as arguments are at -O0, is what
+    // every reload reads
+    if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+      Constant *C = dyn_cast<Constant>(SI->getValueOperand());
+      SmallVector<LoadInst*, 8> reloads;
+      if (!C || !getSpillReloads(SI, reloads)) continue;
+
+      for (unsigned i = 0; i < reloads.size(); ++i) {
+        LoadInst *LI = reloads[i];
+        for (Value::use_iterator UI = LI->use_begin(), E = LI->use_end(); UI != E; ++UI) {
+          worklist.push_back(cast<Instruction>(*UI));
+        }
+        LI->replaceAllUsesWith(C);
+        folded.push_back(LI);
+      }
+      continue;
+    }
+
+    Value *V = 0;
+    if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+      Constant *ptr = dyn_cast<Constant>(LI->getPointerOperand());
+      if (ptr && LI->isSimple()) V = ConstantFoldLoadFromConstPtr(ptr, TD);
+      if (V) FoldedLoads++;
+    } else {
+      V = SimplifyInstruction(I, TD);
+    }
+    if (!V || V == I || I->use_empty()) continue;
+
+    for (Value::use_iterator UI = I->use_begin(), E = I->use_end(); UI != E; ++UI) {
+      worklist.push_back(cast<Instruction>(*UI));
+    }
+    I->replaceAllUsesWith(V);
+    folded.push_back(I);
+  }
+
+  for (unsigned i = 0; i < folded.size(); ++i) {
+    if (Instruction *I = dyn_cast_or_null<Instruction>(folded[i])) {
+      RecursivelyDeleteTriviallyDeadInstructions(I);
+    }
+  }
+
+  for (Function::iterator BB = NF->begin(), E = NF->end(); BB != E; ++BB) {
+    ConstantFoldTerminator(BB);
+  }
+}
+
 void CloneConstantArgs::print(raw_ostream& O, const Module* M) const {
   O << "# functions; # cloned functions; # clones; # calls; # promissor calls; # replaced calls\n";
   O << FunctionsCount << ";" << FunctionsCloned << ";" << ClonesCount << ";" << CallsCount << ";" << PromissorCalls << ";" << CallsReplaced << "\n";
+  budget.print(O);
+  partial.print(O);
 }
 
 // Register the pass to the LLVM framework
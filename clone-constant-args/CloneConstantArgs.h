@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdlib>
 #include <sstream>
 #include <ios>
 #include <fstream>
@@ -13,10 +15,26 @@
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/InstructionSimplify.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/ValueHandle.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "../utils/CloneNaming.h"
+#include "../utils/ColdFunctions.h"
+#include "../utils/CompileBudget.h"
+#include "../utils/PartialCloning.h"
+#include "ArgumentUses.h"
+#include "ConstantEvaluator.h"
+#include "ValueProfileName.h"
 
 #undef DEBUG_TYPE
 #define DEBUG_TYPE "clone-constant-args"
@@ -27,23 +45,42 @@ namespace llvm {
   STATISTIC(CallsCount,      "Number of calls");
   STATISTIC(PromissorCalls,  "Number of promissor calls");
   STATISTIC(CallsReplaced,   "Number of replaced calls");
+  STATISTIC(EvaluatedCalls,  "Number of calls replaced by their result");
+  STATISTIC(WorthlessArgs,   "Number of constant arguments not worth specializing");
+  STATISTIC(FoldedLoads,     "Number of loads from constant globals folded in clones");
+  STATISTIC(GuardedCalls,    "Number of calls guarded by a test of a profiled value");
   class CloneConstantArgs : public ModulePass {
 
     std::map< User*, std::vector< std::pair<Argument*, Value*> > > arguments;
     std::map< Function*, std::vector <User*> > fn2Clone;
 
+    // What a constant would unlock in the function, by formal argument
+    std::map<Argument*, double> argScores;
 
+    CompileBudget budget;
+    PartialCloning partial;
+    DataLayout *TD;
+
+    void guardProfiledValues(Module &M);
+    void readValueProfile(Module &M, std::map<Argument*, std::pair<int64_t, double> > &hotValues);
+    void guardCall(CallInst *CI, Argument *A, ConstantInt *hot, MDNode *weights);
     void findConstantArgs(Module &M);
+    void evaluateConstantCalls(std::vector<CallInst*> &calls);
+    double scoreArgument(Argument *A);
+    void scoreArguments(Function *F);
     bool cloneFunctions();
     void collectFn2Clone();
-    Function* cloneFunctionWithConstArgs(Function *Fn, User* caller, std::string suffix);
+    std::string getSignature(const std::vector< std::pair<Argument*, Value*> > &args, bool &moduleIndependent);
+    Function* cloneFunctionWithConstArgs(Function *Fn, User* caller, std::string name, GlobalValue::LinkageTypes linkage);
     void replaceCallingInst(User* caller, Function* fn);
+    void foldConstantLoads(Function *NF, std::vector<Instruction*> worklist);
 
    public:
 
     static char ID;
 
     CloneConstantArgs();
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
     bool runOnModule(Module &M);
     virtual void print(raw_ostream& O, const Module* M) const;
   };
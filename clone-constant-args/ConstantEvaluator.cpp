@@ -0,0 +1,188 @@
+#include "ConstantEvaluator.h"
+
+using namespace llvm;
+
+ConstantEvaluator::ConstantEvaluator(DataLayout *TD, unsigned maxSteps, unsigned maxDepth)
+  : TD(TD), maxSteps(maxSteps), maxDepth(maxDepth), steps(0) {}
+
+Constant* ConstantEvaluator::evaluate(Function *F, const std::vector<Constant*> &args) {
+  std::pair<Function*, std::vector<Constant*> > key(F, args);
+  std::map<std::pair<Function*, std::vector<Constant*> >, Constant*>::iterator it = results.find(key);
+  if (it != results.end()) return it->second;
+
+  steps = 0;
+  Constant *result = evaluateCall(F, args, 0);
+  results[key] = result;
+  return result;
+}
+
+// Whether AI is only ever loaded from and stored to as a whole, so it is
+// memory of its frame alone
+static bool isFrameLocal(AllocaInst *AI) {
+  if (AI->isArrayAllocation()) return false;
+
+  for (Value::use_iterator UI = AI->use_begin(), E = AI->use_end(); UI != E; ++UI) {
+    if (LoadInst *LI = dyn_cast<LoadInst>(*UI)) {
+      if (!LI->isSimple()) return false;
+    } else if (StoreInst *SI = dyn_cast<StoreInst>(*UI)) {
+      if (!SI->isSimple() || SI->getValueOperand() == AI) return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+Constant* ConstantEvaluator::getValue(Value *V, Frame &values) {
+  if (Constant *C = dyn_cast<Constant>(V)) return C;
+
+  Frame::iterator it = values.find(V);
+  return it != values.end() ? it->second : 0;
+}
+
+// Run F from its entry to a return
+Constant* ConstantEvaluator::evaluateCall(Function *F, const std::vector<Constant*> &args, unsigned depth) {
+  if (depth > maxDepth || F->isDeclaration() || F->mayBeOverridden() || F->isVarArg()) return 0;
+  if (F->getReturnType()->isVoidTy() || args.size() != F->arg_size()) return 0;
+
+  Frame values, slots;
+  unsigned i = 0;
+  for (Function::arg_iterator A = F->arg_begin(), E = F->arg_end(); A != E; ++A, ++i) {
+    values[A] = args[i];
+  }
+
+  BasicBlock *BB = &F->getEntryBlock();
+  BasicBlock *pred = 0;
+  while (true) {
+    // Phis take their values all at once, from the edge we came in by
+    SmallVector<std::pair<PHINode*, Constant*>, 8> phis;
+    BasicBlock::iterator I = BB->begin();
+    for (; PHINode *PN = dyn_cast<PHINode>(I); ++I) {
+      Constant *C = getValue(PN->getIncomingValueForBlock(pred), values);
+      if (!C) return 0;
+      phis.push_back(std::make_pair(PN, C));
+    }
+    for (unsigned j = 0; j < phis.size(); ++j) values[phis[j].first] = phis[j].second;
+
+    BasicBlock *next = 0;
+    for (; !next; ++I) {
+      if (++steps > maxSteps) return 0;
+
+      if (ReturnInst *RI = dyn_cast<ReturnInst>(I)) {
+        return getValue(RI->getReturnValue(), values);
+      }
+
+      if (BranchInst *BI = dyn_cast<BranchInst>(I)) {
+        if (BI->isUnconditional()) {
+          next = BI->getSuccessor(0);
+        } else {
+          ConstantInt *cond = dyn_cast_or_null<ConstantInt>(getValue(BI->getCondition(), values));
+          if (!cond) return 0;
+          next = BI->getSuccessor(cond->isZero() ? 1 : 0);
+        }
+        continue;
+      }
+
+      if (SwitchInst *SI = dyn_cast<SwitchInst>(I)) {
+        ConstantInt *cond = dyn_cast_or_null<ConstantInt>(getValue(SI->getCondition(), values));
+        if (!cond) return 0;
+        next = SI->findCaseValue(cond).getCaseSuccessor();
+        continue;
+      }
+
+      // Unreachable, invokes, unwinding and indirect branches
+      if (isa<TerminatorInst>(I)) return 0;
+
+      if (isa<DbgInfoIntrinsic>(I)) continue;
+
+      if (isa<AllocaInst>(I) || isa<StoreInst>(I) ||
+          (isa<LoadInst>(I) && isa<AllocaInst>(cast<LoadInst>(I)->getPointerOperand()))) {
+        if (!evaluateSlotAccess(I, values, slots)) return 0;
+        continue;
+      }
+
+      Constant *C = evaluateInstruction(I, values, depth);
+      if (!C) return 0;
+      values[I] = C;
+    }
+
+    pred = BB;
+    BB = next;
+  }
+}
+
+// Run an access to a stack slot of the frame, as clang keeps every local
+// variable in one at -O0. slots holds what each slot contains, 0 until it
+// is written. False when I touches other memory or reads an unwritten slot.
+bool ConstantEvaluator::evaluateSlotAccess(Instruction *I, Frame &values, Frame &slots) {
+  if (AllocaInst *AI = dyn_cast<AllocaInst>(I)) {
+    if (!isFrameLocal(AI)) return false;
+    slots[AI] = 0;
+    return true;
+  }
+
+  if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+    Frame::iterator slot = slots.find(SI->getPointerOperand());
+    Constant *C = getValue(SI->getValueOperand(), values);
+    if (slot == slots.end() || !C || isa<UndefValue>(C)) return false;
+    slot->second = C;
+    return true;
+  }
+
+  LoadInst *LI = cast<LoadInst>(I);
+  Frame::iterator slot = slots.find(LI->getPointerOperand());
+  if (slot == slots.end() || !slot->second) return false;
+  values[LI] = slot->second;
+  return true;
+}
+
+// Value of I for the values of its operands, 0 when it is not a constant
+// or I may have an effect
+Constant* ConstantEvaluator::evaluateInstruction(Instruction *I, Frame &values, unsigned depth) {
+  SmallVector<Constant*, 8> ops;
+  if (CallInst *CI = dyn_cast<CallInst>(I)) {
+    for (unsigned i = 0, e = CI->getNumArgOperands(); i != e; ++i) {
+      Constant *C = getValue(CI->getArgOperand(i), values);
+      if (!C) return 0;
+      ops.push_back(C);
+    }
+  } else {
+    for (User::op_iterator it = I->op_begin(), E = I->op_end(); it != E; ++it) {
+      Constant *C = getValue(*it, values);
+      if (!C) return 0;
+      ops.push_back(C);
+    }
+  }
+
+  Constant *result = 0;
+  if (CallInst *CI = dyn_cast<CallInst>(I)) {
+    Function *Callee = CI->getCalledFunction();
+    if (!Callee) return 0;
+
+    if (Callee->isDeclaration()) {
+      if (!canConstantFoldCallTo(Callee)) return 0;
+      result = ConstantFoldCall(Callee, ops);
+    } else {
+      result = evaluateCall(Callee, std::vector<Constant*>(ops.begin(), ops.end()), depth + 1);
+    }
+  } else if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+    // Only constant memory can be read, and it never changes
+    if (!LI->isSimple()) return 0;
+    result = ConstantFoldLoadFromConstPtr(ops[0], TD);
+  } else if (I->mayReadOrWriteMemory()) {
+    return 0;
+  } else if (CmpInst *CI = dyn_cast<CmpInst>(I)) {
+    result = ConstantFoldCompareInstOperands(CI->getPredicate(), ops[0], ops[1], TD);
+  } else if (ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(I)) {
+    result = ConstantExpr::getExtractValue(ops[0], EVI->getIndices());
+  } else if (InsertValueInst *IVI = dyn_cast<InsertValueInst>(I)) {
+    result = ConstantExpr::getInsertValue(ops[0], ops[1], IVI->getIndices());
+  } else {
+    result = ConstantFoldInstOperands(I->getOpcode(), I->getType(), ops, TD);
+  }
+
+  // Undefined results come from code that would trap, like a division by
+  // zero, which must still happen at run time
+  if (result && isa<UndefValue>(result)) return 0;
+  return result;
+}
@@ -0,0 +1,45 @@
+#include <map>
+#include <vector>
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/ConstantFolding.h"
+
+namespace llvm {
+
+  // Runs calls with constant arguments at compile time, instruction by
+  // instruction. Only code that does not touch memory can be run, except
+  // for loads from constant globals and the stack slots that never leave
+  // their frame, so a call that completes has no effect other than its
+  // result. Gives up when a call takes more steps, or nests deeper, than
+  // allowed.
+  class ConstantEvaluator {
+
+    typedef DenseMap<Value*, Constant*> Frame;
+
+    DataLayout *TD;
+    unsigned maxSteps;
+    unsigned maxDepth;
+    unsigned steps;
+
+    // Results of the calls run so far, 0 for the ones that could not be
+    std::map<std::pair<Function*, std::vector<Constant*> >, Constant*> results;
+
+    Constant* getValue(Value *V, Frame &values);
+    bool evaluateSlotAccess(Instruction *I, Frame &values, Frame &slots);
+    Constant* evaluateInstruction(Instruction *I, Frame &values, unsigned depth);
+    Constant* evaluateCall(Function *F, const std::vector<Constant*> &args, unsigned depth);
+
+   public:
+
+    ConstantEvaluator(DataLayout *TD, unsigned maxSteps, unsigned maxDepth);
+
+    // Result of calling F with args, or 0 when it cannot be computed
+    Constant* evaluate(Function *F, const std::vector<Constant*> &args);
+  };
+}
@@ -0,0 +1,24 @@
+#ifndef CBO_VALUE_PROFILE_NAME_H
+#define CBO_VALUE_PROFILE_NAME_H
+
+#include <algorithm>
+#include <string>
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+namespace llvm {
+
+  // Name of F in the value profile, the same for the value-profiler pass
+  // that writes it and for clone-constant-args that reads it. Internal
+  // functions of different files may share a name, so theirs is qualified
+  // with the identifier of their module. Spaces would split a profile line.
+  inline std::string getValueProfileName(const Function &F) {
+    std::string name = F.getName();
+    if (F.hasLocalLinkage()) name = F.getParent()->getModuleIdentifier() + ":" + name;
+    std::replace(name.begin(), name.end(), ' ', '_');
+    return name;
+  }
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "ValueProfiler.h"
+
+using namespace llvm;
+
+// Must match CBO_VALUES_PER_SITE in the run time library
+static const unsigned ValuesPerSite = 8;
+
+ValueProfiler::ValueProfiler() : ModulePass(ID) {
+  ProfiledFunctions = 0;
+  ProfiledArgs      = 0;
+}
+
+bool ValueProfiler::runOnModule(Module &M) {
+  LLVMContext &Ctx = M.getContext();
+  Type *Int8PtrTy = Type::getInt8PtrTy(Ctx);
+  Type *Int32Ty   = Type::getInt32Ty(Ctx);
+  Type *Int64Ty   = Type::getInt64Ty(Ctx);
+
+  // struct CBOValueSite of the run time library
+  Type *fields[] = { Int8PtrTy, Int32Ty, Int32Ty, Int8PtrTy, Int64Ty,
+                     ArrayType::get(Int64Ty, ValuesPerSite),
+                     ArrayType::get(Int64Ty, ValuesPerSite) };
+  siteTy = StructType::create(Ctx, fields, "struct.CBOValueSite");
+
+  Type *params[] = { PointerType::getUnqual(siteTy), Int64Ty };
+  profileFn = M.getOrInsertFunction("__cbo_profile_value",
+                                    FunctionType::get(Type::getVoidTy(Ctx), params, false));
+
+  bool modified = false;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    // Only functions with callers to redirect can be specialized
+    if (F->isDeclaration() || F->mayBeOverridden() || F->isVarArg() || F->use_empty()) continue;
+    if (&*F == profileFn) continue;
+
+    std::vector<Argument*> args;
+    for (Function::arg_iterator A = F->arg_begin(), AE = F->arg_end(); A != AE; ++A) {
+      if (isWorthProfiling(A)) args.push_back(A);
+    }
+    if (args.empty()) continue;
+
+    instrument(*F, args);
+    ProfiledFunctions++;
+    modified = true;
+  }
+
+  return modified;
+}
+
+// Whether A is an integer that decides a branch, a switch or a division,
+// directly or through the values computed from it. Arguments spilled to the
+// stack, as at -O0, are followed through their reloads.
+bool ValueProfiler::isWorthProfiling(Argument *A) {
+  IntegerType *Ty = dyn_cast<IntegerType>(A->getType());
+  if (!Ty || Ty->getBitWidth() > 64) return false;
+
+  ArgumentUseWalker uses(A);
+  while (Use *U = uses.next()) {
+    Instruction *I = dyn_cast<Instruction>(U->getUser());
+    if (!I) continue;
+
+    if (isa<BranchInst>(I) || isa<SwitchInst>(I)) return true;
+
+    if (BinaryOperator *BO = dyn_cast<BinaryOperator>(I)) {
+      switch (BO->getOpcode()) {
+        case Instruction::UDiv:
+        case Instruction::SDiv:
+        case Instruction::URem:
+        case Instruction::SRem:
+          if (U->getOperandNo() == 1) return true;
+          break;
+        default:
+          break;
+      }
+      uses.follow(I);
+    } else if (isa<CastInst>(I) || isa<CmpInst>(I) || isa<SelectInst>(I) || isa<PHINode>(I)) {
+      uses.follow(I);
+    }
+  }
+
+  return false;
+}
+
+// Count the values of args at the entry of F, each in a site of its own
+void ValueProfiler::instrument(Function &F, const std::vector<Argument*> &args) {
+  Module *M = F.getParent();
+  IRBuilder<> Builder(F.getEntryBlock().getFirstInsertionPt());
+
+  Constant *name = cast<Constant>(Builder.CreateGlobalStringPtr(getValueProfileName(F), "cbo.fn"));
+
+  for (std::vector<Argument*>::const_iterator it = args.begin(); it != args.end(); ++it) {
+    Argument *A = *it;
+
+    Constant *init[] = { name,
+                         Builder.getInt32(A->getArgNo()),
+                         Builder.getInt32(0),
+                         Constant::getNullValue(Builder.getInt8PtrTy()),
+                         Builder.getInt64(0),
+                         Constant::getNullValue(siteTy->getElementType(5)),
+                         Constant::getNullValue(siteTy->getElementType(6)) };
+    GlobalVariable *site = new GlobalVariable(*M, siteTy, false, GlobalValue::InternalLinkage,
+                                              ConstantStruct::get(siteTy, init), "cbo.site");
+
+    Builder.CreateCall2(profileFn, site, Builder.CreateSExt(A, Builder.getInt64Ty()));
+    ProfiledArgs++;
+  }
+}
+
+void ValueProfiler::print(raw_ostream& O, const Module* M) const {
+  O << "Number of functions with profiled arguments: " << ProfiledFunctions << '\n';
+  O << "Number of profiled arguments: " << ProfiledArgs << '\n';
+}
+
+// Register the pass to the LLVM framework
+char ValueProfiler::ID = 0;
+static RegisterPass<ValueProfiler> X("value-profiler", "Count the values of the arguments that decide branches.", false, false);
@@ -0,0 +1,46 @@
+#include <string>
+#include <set>
+#include <vector>
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/ADT/Statistic.h"
+#include "ArgumentUses.h"
+#include "ValueProfileName.h"
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "value-profiler"
+namespace llvm {
+  STATISTIC(ProfiledFunctions, "Number of functions with profiled arguments");
+  STATISTIC(ProfiledArgs,      "Number of profiled arguments");
+
+  // Instruments the integer arguments that decide branches, switches or
+  // divisions, so the run time library counts the values they take. The
+  // profile lets clone-constant-args specialize the functions for values
+  // that are passed nearly every time, behind a test of the argument.
+  // Programs must be linked with the CBOProfileRuntime library.
+  class ValueProfiler : public ModulePass {
+
+    StructType *siteTy;
+    Constant *profileFn;
+
+    bool isWorthProfiling(Argument *A);
+    void instrument(Function &F, const std::vector<Argument*> &args);
+
+   public:
+
+    static char ID;
+
+    ValueProfiler();
+    bool runOnModule(Module &M);
+    virtual void print(raw_ostream& O, const Module* M) const;
+  };
+}
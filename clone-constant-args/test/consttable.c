@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  int size;
+  const int *weights;
+} Band;
+
+typedef struct {
+  int nbBands;
+  Band bands[2];
+} Mode;
+
+static const int narrowWeights[] = {1, 2, 3, 4};
+static const int wideWeights[] = {5, 6, 7, 8, 9, 10, 11, 12};
+
+static const Mode narrow = {2, {{4, narrowWeights}, {2, narrowWeights}}};
+static const Mode wide = {2, {{8, wideWeights}, {4, wideWeights}}};
+
+int energy(const Mode *mode, int x) {
+  int sum = 0;
+  for (int b = 0; b < mode->nbBands; b++)
+    for (int i = 0; i < mode->bands[b].size; i++)
+      sum += mode->bands[b].weights[i] * x;
+
+  return sum;
+}
+int main() {
+  for (int i = 0; i < 10000000; i++) {
+    int result = energy(&narrow, i);
+    printf("%d", result);
+     result = energy(&wide, i);
+    printf("%d", result);
+  }
+}
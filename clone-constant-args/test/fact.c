@@ -0,0 +1,16 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+int fact(int n) {
+  if (n <= 1)
+    return 1;
+  return n * fact(n - 1);
+}
+int main() {
+  for (int i = 0; i < 10000000; i++) {
+    int result = fact(10);
+    printf("%d", result);
+     result = fact(i & 7);
+    printf("%d", result);
+  }
+}
@@ -0,0 +1,222 @@
+#include "CloneNonnull.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+NonnullTimeBudget("clone-nonnull-time-budget", cl::init(0),
+                  cl::desc("Seconds clone-nonnull may take before it stops cloning (0: no limit)"));
+
+static cl::opt<unsigned>
+NonnullMemoryBudget("clone-nonnull-memory-budget", cl::init(0),
+                    cl::desc("Megabytes clone-nonnull may use before it stops cloning (0: no limit)"));
+
+// The pointer I compares against null, if it is an equality test with null
+static Value* getNullCheckedPointer(Instruction *I) {
+  ICmpInst *IC = dyn_cast<ICmpInst>(I);
+  if (!IC || !IC->isEquality() || !IC->getOperand(0)->getType()->isPointerTy()) return 0;
+
+  if (isa<ConstantPointerNull>(IC->getOperand(1))) return IC->getOperand(0);
+  if (isa<ConstantPointerNull>(IC->getOperand(0))) return IC->getOperand(1);
+  return 0;
+}
+
+void CloneNonnull::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<DominatorTree>();
+}
+
+CloneNonnull::CloneNonnull() : ModulePass(ID), budget("clone-nonnull") {
+  NonnullFunctions = 0;
+  NonnullCalls = 0;
+  NonnullClones = 0;
+  NonnullFoldedChecks = 0;
+}
+
+bool CloneNonnull::runOnModule(Module &M) {
+  budget.reset(NonnullTimeBudget, NonnullMemoryBudget);
+
+  findCheckedArgs(M);
+  if (checkedArgs.empty()) return false;
+
+  // Decide everything before cloning, so the callers are looked at as they
+  // were written
+  std::vector<Decision> decisions;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!F->isDeclaration()) decide(*F, decisions);
+  }
+
+  for (std::vector<Decision>::iterator it = decisions.begin(); it != decisions.end(); ++it) {
+    // Keep the clones made so far, but do not make new ones
+    if (budget.exceeded()) {
+      budget.degrade("stopped creating nonnull clones");
+      break;
+    }
+
+    CallSite CS(it->call);
+    CS.setCalledFunction(getNonnullClone(CS.getCalledFunction(), it->args));
+    NonnullCalls++;
+  }
+
+  return !decisions.empty();
+}
+
+void CloneNonnull::findCheckedArgs(Module &M) {
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration() || F->mayBeOverridden()) continue;
+
+    std::set<unsigned> args;
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+      for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+        Value *ptr = getNullCheckedPointer(I);
+        if (!ptr) continue;
+
+        if (Argument *A = dyn_cast<Argument>(ptr->stripInBoundsOffsets())) {
+          args.insert(A->getArgNo());
+        }
+      }
+    }
+
+    if (!args.empty()) {
+      checkedArgs[F] = args;
+      NonnullFunctions++;
+    }
+  }
+}
+
+// Collect the calls of F that pass non-null pointers to arguments their
+// callee checks against null
+void CloneNonnull::decide(Function &F, std::vector<Decision> &decisions) {
+  DominatorTree *DT = 0;
+
+  for (Function::iterator BB = F.begin(), BE = F.end(); BB != BE; ++BB) {
+    for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+      CallSite CS(I);
+      if (!CS) continue;
+
+      Function *Callee = CS.getCalledFunction();
+      std::map<Function*, std::set<unsigned> >::iterator checked = checkedArgs.find(Callee);
+      if (!Callee || checked == checkedArgs.end() || CS.arg_size() != Callee->arg_size()) continue;
+
+      if (!DT) DT = &getAnalysis<DominatorTree>(F);
+
+      Decision D;
+      D.call = I;
+      for (std::set<unsigned>::iterator A = checked->second.begin(); A != checked->second.end(); ++A) {
+        if (isKnownNonNull(CS.getArgument(*A), I, *DT)) D.args.insert(*A);
+      }
+      if (!D.args.empty()) decisions.push_back(D);
+    }
+  }
+}
+
+// Whether V cannot be null when At runs
+bool CloneNonnull::isKnownNonNull(Value *V, Instruction *At, DominatorTree &DT) {
+  V = V->stripInBoundsOffsets();
+
+  if (isa<AllocaInst>(V)) return true;
+  if (GlobalValue *GV = dyn_cast<GlobalValue>(V)) return !GV->hasExternalWeakLinkage();
+  if (isa<Constant>(V)) return false;
+
+  if (Argument *A = dyn_cast<Argument>(V)) {
+    if (A->hasByValAttr()) return true;
+  }
+
+  // Null is a valid address in other address spaces
+  bool derefImpliesNonNull = cast<PointerType>(V->getType())->getAddressSpace() == 0;
+
+  for (Value::use_iterator UI = V->use_begin(), E = V->use_end(); UI != E; ++UI) {
+    Instruction *U = dyn_cast<Instruction>(*UI);
+    if (!U) continue;
+
+    // Dereferenced before the call
+    if (derefImpliesNonNull) {
+      if (LoadInst *LI = dyn_cast<LoadInst>(U)) {
+        if (LI->getPointerOperand() == V && DT.dominates(LI, At)) return true;
+      } else if (StoreInst *SI = dyn_cast<StoreInst>(U)) {
+        if (SI->getPointerOperand() == V && DT.dominates(SI, At)) return true;
+      }
+    }
+
+    // Checked against null on a branch the call is behind
+    if (getNullCheckedPointer(U) != V) continue;
+    bool isNe = cast<ICmpInst>(U)->getPredicate() == ICmpInst::ICMP_NE;
+
+    for (Value::use_iterator CI = U->use_begin(), CE = U->use_end(); CI != CE; ++CI) {
+      BranchInst *BI = dyn_cast<BranchInst>(*CI);
+      if (!BI || !BI->isConditional()) continue;
+
+      BasicBlockEdge edge(BI->getParent(), BI->getSuccessor(isNe ? 0 : 1));
+      if (DT.dominates(edge, At->getParent())) return true;
+    }
+  }
+
+  return false;
+}
+
+// Clone of F whose args are known not to be null
+Function* CloneNonnull::getNonnullClone(Function *F, const std::set<unsigned> &args) {
+  std::pair<Function*, std::set<unsigned> > key(F, args);
+  std::map<std::pair<Function*, std::set<unsigned> >, Function*>::iterator it = clones.find(key);
+  if (it != clones.end()) return it->second;
+
+  std::string signature;
+  for (std::set<unsigned>::const_iterator A = args.begin(); A != args.end(); ++A) {
+    signature += utostr(*A) + ";";
+  }
+
+  std::string name = getCloneName(F->getName(), ".nonnull", signature);
+  Function *NF = F->getParent()->getFunction(name);
+
+  if (!NF || NF->getFunctionType() != F->getFunctionType()) {
+    ValueToValueMapTy VMap;
+    NF = CloneFunction(F, VMap, false);
+    NF->setLinkage(getCloneLinkage(F));
+    NF->setName(name);
+    F->getParent()->getFunctionList().insert(F, NF);
+
+    foldNullChecks(NF, args);
+    NonnullClones++;
+  }
+
+  clones[key] = NF;
+  return NF;
+}
+
+// Fold the null checks of the args of NF, and the branches on them
+void CloneNonnull::foldNullChecks(Function *NF, const std::set<unsigned> &args) {
+  std::set<Value*> nonnull;
+  for (Function::arg_iterator A = NF->arg_begin(), E = NF->arg_end(); A != E; ++A) {
+    if (args.count(A->getArgNo())) nonnull.insert(A);
+  }
+
+  std::vector<ICmpInst*> checks;
+  for (Function::iterator BB = NF->begin(), BE = NF->end(); BB != BE; ++BB) {
+    for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+      Value *ptr = getNullCheckedPointer(I);
+      if (ptr && nonnull.count(ptr->stripInBoundsOffsets())) checks.push_back(cast<ICmpInst>(I));
+    }
+  }
+
+  for (std::vector<ICmpInst*>::iterator it = checks.begin(); it != checks.end(); ++it) {
+    ICmpInst *IC = *it;
+    bool isNe = IC->getPredicate() == ICmpInst::ICMP_NE;
+    IC->replaceAllUsesWith(ConstantInt::get(IC->getType(), isNe));
+    IC->eraseFromParent();
+    NonnullFoldedChecks++;
+  }
+
+  for (Function::iterator BB = NF->begin(), BE = NF->end(); BB != BE; ++BB) {
+    ConstantFoldTerminator(BB);
+  }
+}
+
+void CloneNonnull::print(raw_ostream& O, const Module* M) const {
+  O << "Number of functions that check arguments against null: " << NonnullFunctions << '\n';
+  O << "Number of calls redirected to nonnull clones: " << NonnullCalls << '\n';
+  O << "Number of nonnull clones: " << NonnullClones << '\n';
+  O << "Number of null checks folded in clones: " << NonnullFoldedChecks << '\n';
+  budget.print(O);
+}
+
+// Register the pass to the LLVM framework
+char CloneNonnull::ID = 0;
+static RegisterPass<CloneNonnull> X("clone-nonnull", "Clone functions for calls with arguments known not to be null.", false, false);
@@ -0,0 +1,63 @@
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/Dominators.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "../utils/CloneNaming.h"
+#include "../utils/CompileBudget.h"
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "clone-nonnull"
+namespace llvm {
+  STATISTIC(NonnullFunctions,    "Number of functions that check arguments against null");
+  STATISTIC(NonnullCalls,        "Number of calls redirected to nonnull clones");
+  STATISTIC(NonnullClones,       "Number of nonnull clones");
+  STATISTIC(NonnullFoldedChecks, "Number of null checks folded in clones");
+
+  // Clones functions that check pointer arguments against null for the
+  // calls that pass pointers known not to be null: allocas, globals, byval
+  // arguments, and pointers dereferenced or checked against null before
+  // the call. The null checks on those arguments are folded in the clone.
+  class CloneNonnull : public ModulePass {
+
+    // A call and the arguments it passes that are not null
+    struct Decision {
+      Instruction *call;
+      std::set<unsigned> args;
+    };
+
+    CompileBudget budget;
+
+    // Arguments each function checks against null
+    std::map<Function*, std::set<unsigned> > checkedArgs;
+
+    std::map<std::pair<Function*, std::set<unsigned> >, Function*> clones;
+
+    void findCheckedArgs(Module &M);
+    void decide(Function &F, std::vector<Decision> &decisions);
+    bool isKnownNonNull(Value *V, Instruction *At, DominatorTree &DT);
+    Function* getNonnullClone(Function *F, const std::set<unsigned> &args);
+    void foldNullChecks(Function *NF, const std::set<unsigned> &args);
+
+   public:
+
+    static char ID;
+
+    CloneNonnull();
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
+    bool runOnModule(Module &M);
+    virtual void print(raw_ostream& O, const Module* M) const;
+  };
+}
@@ -0,0 +1,258 @@
+#include "CloneNounwind.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+NounwindTimeBudget("clone-nounwind-time-budget", cl::init(0),
+                   cl::desc("Seconds clone-nounwind may take before it stops cloning (0: no limit)"));
+
+static cl::opt<unsigned>
+NounwindMemoryBudget("clone-nounwind-memory-budget", cl::init(0),
+                     cl::desc("Megabytes clone-nounwind may use before it stops cloning (0: no limit)"));
+
+CloneNounwind::CloneNounwind() : ModulePass(ID), budget("clone-nounwind") {
+  NounwindFunctions   = 0;
+  NounwindCalls       = 0;
+  NounwindClones      = 0;
+  NounwindInvokes     = 0;
+  NounwindLandingPads = 0;
+}
+
+bool CloneNounwind::runOnModule(Module &M) {
+  budget.reset(NounwindTimeBudget, NounwindMemoryBudget);
+  bool modified = false;
+
+  // Functions that cannot unwind whatever they are passed need no clone
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration() || F->mayBeOverridden() || F->doesNotThrow()) continue;
+    if (callsMayUnwind(F, Specialization(), true)) continue;
+
+    removeUnwinding(F);
+    mayUnwindCache[F] = false;
+    NounwindFunctions++;
+    modified = true;
+  }
+
+  // Decide everything before cloning, so the callers are looked at as they
+  // were written
+  std::vector<Decision> decisions;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration() || F->doesNotThrow()) continue;
+
+    std::set<unsigned> invoked = getInvokedArgs(F);
+    if (invoked.empty()) continue;
+
+    for (Value::use_iterator UI = F->use_begin(), UE = F->use_end(); UI != UE; ++UI) {
+      CallSite CS(*UI);
+      if (!CS || !CS.isCallee(UI) || CS.arg_size() != F->arg_size()) continue;
+
+      Decision D;
+      D.call = CS.getInstruction();
+      for (std::set<unsigned>::iterator A = invoked.begin(); A != invoked.end(); ++A) {
+        Function *G = dyn_cast<Function>(CS.getArgument(*A)->stripPointerCasts());
+        if (G && !mayUnwind(G)) D.spec[*A] = G;
+      }
+      if (!D.spec.empty() && !callsMayUnwind(F, D.spec, true)) decisions.push_back(D);
+    }
+  }
+
+  std::set<Function*> callers;
+  for (std::vector<Decision>::iterator it = decisions.begin(); it != decisions.end(); ++it) {
+    // Keep the clones made so far, but do not make new ones
+    if (budget.exceeded()) {
+      budget.degrade("stopped creating nounwind clones");
+      break;
+    }
+
+    CallSite CS(it->call);
+    CS.setCalledFunction(getNounwindClone(CS.getCalledFunction(), it->spec));
+    if (InvokeInst *II = dyn_cast<InvokeInst>(it->call)) changeToCall(II);
+    callers.insert(it->call->getParent()->getParent());
+    NounwindCalls++;
+    modified = true;
+  }
+
+  // Only now, as the blocks removed may have held calls still to redirect
+  for (std::set<Function*>::iterator F = callers.begin(); F != callers.end(); ++F) {
+    removeUnreachableBlocks(*F);
+  }
+
+  return modified;
+}
+
+// Arguments of F that F calls
+std::set<unsigned> CloneNounwind::getInvokedArgs(Function *F) {
+  std::set<unsigned> invoked;
+  for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+    for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+      CallSite CS(I);
+      if (!CS) continue;
+
+      if (Argument *A = dyn_cast<Argument>(CS.getCalledValue()->stripPointerCasts())) {
+        invoked.insert(A->getArgNo());
+      }
+    }
+  }
+  return invoked;
+}
+
+// Whether an exception may leave F. It may not if none of the calls of F
+// may unwind and, unless F never resumes unwinding, none of its invokes.
+bool CloneNounwind::mayUnwind(Function *F) {
+  if (F->doesNotThrow()) return false;
+  if (F->isDeclaration() || F->mayBeOverridden()) return true;
+
+  std::map<Function*, bool>::iterator it = mayUnwindCache.find(F);
+  if (it != mayUnwindCache.end()) return it->second;
+
+  // Recursive calls are assumed to unwind
+  mayUnwindCache[F] = true;
+
+  bool resumes = false;
+  for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+    resumes = resumes || isa<ResumeInst>(BB->getTerminator());
+  }
+
+  Specialization none;
+  bool result = callsMayUnwind(F, none, false) || (resumes && callsMayUnwind(F, none, true));
+  mayUnwindCache[F] = result;
+  return result;
+}
+
+bool CloneNounwind::mayUnwind(CallSite CS, const Specialization &spec) {
+  if (CS.doesNotThrow()) return false;
+
+  Function *G = getCalledFunction(CS, spec);
+  return !G || mayUnwind(G);
+}
+
+// Whether a call of F, or if invokes is set any call or invoke of F, may
+// unwind once the arguments of F in spec are the functions they map to
+bool CloneNounwind::callsMayUnwind(Function *F, const Specialization &spec, bool invokes) {
+  for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+    for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+      CallSite CS(I);
+      if (!CS || (CS.isInvoke() && !invokes)) continue;
+      if (mayUnwind(CS, spec)) return true;
+    }
+  }
+  return false;
+}
+
+// Function CS calls, given the functions the arguments in spec map to
+Function* CloneNounwind::getCalledFunction(CallSite CS, const Specialization &spec) {
+  Value *V = CS.getCalledValue()->stripPointerCasts();
+
+  if (Argument *A = dyn_cast<Argument>(V)) {
+    Specialization::const_iterator it = spec.find(A->getArgNo());
+    return it != spec.end() ? it->second : 0;
+  }
+  return dyn_cast<Function>(V);
+}
+
+// Clone of F calling the functions of spec instead of its arguments
+Function* CloneNounwind::getNounwindClone(Function *F, const Specialization &spec) {
+  std::pair<Function*, Specialization> key(F, spec);
+  std::map<std::pair<Function*, Specialization>, Function*>::iterator it = clones.find(key);
+  if (it != clones.end()) return it->second;
+
+  std::string signature;
+  bool moduleIndependent = true;
+  for (Specialization::const_iterator S = spec.begin(); S != spec.end(); ++S) {
+    appendConstantSignature(signature, S->first, S->second, F->getParent());
+    moduleIndependent = moduleIndependent && isModuleIndependent(S->second);
+  }
+
+  std::string name = getCloneName(F->getName(), ".nounwind", signature);
+  Function *NF = F->getParent()->getFunction(name);
+
+  if (!NF || NF->getFunctionType() != F->getFunctionType()) {
+    ValueToValueMapTy VMap;
+    NF = CloneFunction(F, VMap, false);
+    NF->setLinkage(getCloneLinkage(F, moduleIndependent));
+    NF->setName(name);
+    F->getParent()->getFunctionList().insert(F, NF);
+
+    Function::arg_iterator A = NF->arg_begin();
+    for (unsigned i = 0; A != NF->arg_end(); ++A, ++i) {
+      Specialization::const_iterator S = spec.find(i);
+      if (S != spec.end()) A->replaceAllUsesWith(ConstantExpr::getBitCast(S->second, A->getType()));
+    }
+
+    removeUnwinding(NF);
+    NounwindClones++;
+  }
+
+  clones[key] = NF;
+  return NF;
+}
+
+// Turn the invokes of F, none of which may unwind, into calls, and drop the
+// landing pads left unreachable
+void CloneNounwind::removeUnwinding(Function *F) {
+  std::vector<InvokeInst*> invokes;
+  for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+    if (InvokeInst *II = dyn_cast<InvokeInst>(BB->getTerminator())) invokes.push_back(II);
+  }
+
+  for (std::vector<InvokeInst*>::iterator II = invokes.begin(); II != invokes.end(); ++II) {
+    changeToCall(*II);
+  }
+  removeUnreachableBlocks(F);
+  F->addFnAttr(Attribute::NoUnwind);
+}
+
+void CloneNounwind::changeToCall(InvokeInst *II) {
+  CallSite CS(II);
+  std::vector<Value*> args(CS.arg_begin(), CS.arg_end());
+
+  CallInst *CI = CallInst::Create(II->getCalledValue(), args, "", II);
+  CI->takeName(II);
+  CI->setCallingConv(II->getCallingConv());
+  CI->setAttributes(II->getAttributes());
+  CI->setDebugLoc(II->getDebugLoc());
+  II->replaceAllUsesWith(CI);
+
+  BranchInst::Create(II->getNormalDest(), II);
+  II->getUnwindDest()->removePredecessor(II->getParent());
+  II->eraseFromParent();
+  NounwindInvokes++;
+}
+
+void CloneNounwind::removeUnreachableBlocks(Function *F) {
+  SmallPtrSet<BasicBlock*, 32> reachable;
+  std::vector<BasicBlock*> worklist(1, &F->getEntryBlock());
+  while (!worklist.empty()) {
+    BasicBlock *BB = worklist.back();
+    worklist.pop_back();
+    if (!reachable.insert(BB)) continue;
+    worklist.insert(worklist.end(), succ_begin(BB), succ_end(BB));
+  }
+
+  std::vector<BasicBlock*> dead;
+  for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+    if (reachable.count(BB)) continue;
+
+    dead.push_back(BB);
+    if (BB->isLandingPad()) NounwindLandingPads++;
+    for (succ_iterator S = succ_begin(BB), SE = succ_end(BB); S != SE; ++S) {
+      if (reachable.count(*S)) (*S)->removePredecessor(BB);
+    }
+  }
+
+  for (unsigned i = 0; i < dead.size(); ++i) dead[i]->dropAllReferences();
+  for (unsigned i = 0; i < dead.size(); ++i) dead[i]->eraseFromParent();
+}
+
+void CloneNounwind::print(raw_ostream& O, const Module* M) const {
+  O << "Number of functions made nounwind in place: " << NounwindFunctions << '\n';
+  O << "Number of calls redirected to nounwind clones: " << NounwindCalls << '\n';
+  O << "Number of nounwind clones: " << NounwindClones << '\n';
+  O << "Number of invokes turned into calls: " << NounwindInvokes << '\n';
+  O << "Number of landing pads removed: " << NounwindLandingPads << '\n';
+  budget.print(O);
+}
+
+// Register the pass to the LLVM framework
+char CloneNounwind::ID = 0;
+static RegisterPass<CloneNounwind> X("clone-nounwind", "Clone functions for calls passing callbacks that cannot unwind.", false, false);
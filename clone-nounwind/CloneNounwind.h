@@ -0,0 +1,75 @@
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "../utils/CloneNaming.h"
+#include "../utils/CompileBudget.h"
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "clone-nounwind"
+namespace llvm {
+  STATISTIC(NounwindFunctions,     "Number of functions made nounwind in place");
+  STATISTIC(NounwindCalls,         "Number of calls redirected to nounwind clones");
+  STATISTIC(NounwindClones,        "Number of nounwind clones");
+  STATISTIC(NounwindInvokes,       "Number of invokes turned into calls");
+  STATISTIC(NounwindLandingPads,   "Number of landing pads removed");
+
+  // Clones functions that invoke the function pointers they take, for the
+  // calls that pass functions which cannot unwind. The clone calls those
+  // functions directly, so its invokes become calls and its landing pads
+  // go away. Functions whose calls cannot unwind whatever they are passed
+  // are changed in place instead. Calls redirected to a nounwind function
+  // lose their own landing pads too.
+  class CloneNounwind : public ModulePass {
+
+    // Function pointer arguments specialized to a function, by number
+    typedef std::map<unsigned, Function*> Specialization;
+
+    // A call and what it passes to function pointer arguments that cannot
+    // unwind
+    struct Decision {
+      Instruction *call;
+      Specialization spec;
+    };
+
+    CompileBudget budget;
+
+    // Whether each function looked at may unwind, whatever it is passed
+    std::map<Function*, bool> mayUnwindCache;
+
+    std::map<std::pair<Function*, Specialization>, Function*> clones;
+
+    std::set<unsigned> getInvokedArgs(Function *F);
+    bool mayUnwind(Function *F);
+    bool mayUnwind(CallSite CS, const Specialization &spec);
+    bool callsMayUnwind(Function *F, const Specialization &spec, bool invokes);
+    Function* getCalledFunction(CallSite CS, const Specialization &spec);
+    Function* getNounwindClone(Function *F, const Specialization &spec);
+    void removeUnwinding(Function *F);
+    void changeToCall(InvokeInst *II);
+    void removeUnreachableBlocks(Function *F);
+
+   public:
+
+    static char ID;
+
+    CloneNounwind();
+    bool runOnModule(Module &M);
+    virtual void print(raw_ostream& O, const Module* M) const;
+  };
+}
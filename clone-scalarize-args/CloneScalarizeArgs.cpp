@@ -0,0 +1,313 @@
+#include "CloneScalarizeArgs.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+ScalarizeTimeBudget("clone-scalarize-args-time-budget", cl::init(0),
+                    cl::desc("Seconds clone-scalarize-args may take before it stops cloning (0: no limit)"));
+
+static cl::opt<unsigned>
+ScalarizeMemoryBudget("clone-scalarize-args-memory-budget", cl::init(0),
+                      cl::desc("Megabytes clone-scalarize-args may use before it stops cloning (0: no limit)"));
+
+static cl::opt<unsigned>
+ScalarizeMaxFields("clone-scalarize-args-max-fields", cl::init(4),
+                   cl::desc("Fields a struct argument may be read from to be passed as scalars"));
+
+static Argument* getArgument(Function *F, unsigned argNo) {
+  Function::arg_iterator A = F->arg_begin();
+  std::advance(A, argNo);
+  return A;
+}
+
+// Attributes of a function, or of a call to it, once each of its arguments
+// is passed as widths[argNo] values. Arguments passed field by field lose
+// their attributes, which were about the pointer.
+static AttributeSet remapAttributes(const AttributeSet &PAL, LLVMContext &Ctx, const std::vector<unsigned> &widths) {
+  SmallVector<AttributeSet, 8> attrs;
+  if (PAL.hasAttributes(AttributeSet::ReturnIndex)) attrs.push_back(PAL.getRetAttributes());
+
+  unsigned index = 1;
+  for (unsigned i = 0; i < widths.size(); ++i) {
+    if (widths[i] != 1) {
+      index += widths[i];
+      continue;
+    }
+    if (PAL.hasAttributes(i + 1)) {
+      AttrBuilder B(PAL, i + 1);
+      attrs.push_back(AttributeSet::get(Ctx, index, B));
+    }
+    ++index;
+  }
+
+  if (PAL.hasAttributes(AttributeSet::FunctionIndex)) attrs.push_back(PAL.getFnAttributes());
+  return AttributeSet::get(Ctx, attrs);
+}
+
+CloneScalarizeArgs::CloneScalarizeArgs() : ModulePass(ID), budget("clone-scalarize-args") {
+  ScalarizableArgs = 0;
+  ScalarizedCalls  = 0;
+  ScalarizedClones = 0;
+  ScalarizedFields = 0;
+}
+
+bool CloneScalarizeArgs::runOnModule(Module &M) {
+  budget.reset(ScalarizeTimeBudget, ScalarizeMemoryBudget);
+
+  findScalarizableArgs(M);
+  if (fields.empty()) return false;
+
+  // Decide everything before cloning, while the summaries describe the
+  // functions as they were written
+  std::vector<Decision> decisions;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    std::vector<Argument*> candidates;
+    for (Function::arg_iterator A = F->arg_begin(), AE = F->arg_end(); A != AE; ++A) {
+      if (fields.count(A)) candidates.push_back(A);
+    }
+    if (candidates.empty()) continue;
+
+    for (Value::use_iterator UI = F->use_begin(), UE = F->use_end(); UI != UE; ++UI) {
+      CallSite CS(*UI);
+      if (!CS || !CS.isCallee(UI) || CS.arg_size() != F->arg_size()) continue;
+
+      Decision D;
+      D.call = CS.getInstruction();
+      for (unsigned i = 0; i < candidates.size(); ++i) {
+        if (isUnchangedDuringCall(CS, candidates[i])) D.args.push_back(candidates[i]->getArgNo());
+      }
+      if (!D.args.empty()) decisions.push_back(D);
+    }
+  }
+
+  for (std::vector<Decision>::iterator it = decisions.begin(); it != decisions.end(); ++it) {
+    // Keep the clones made so far, but do not make new ones
+    if (budget.exceeded()) {
+      budget.degrade("stopped creating scalarized clones");
+      break;
+    }
+
+    Function *Caller = it->call->getParent()->getParent();
+    Function *NF = getScalarizedClone(CallSite(it->call).getCalledFunction(), it->args);
+    rewriteCall(it->call, NF, it->args);
+    modRef.invalidate(Caller);
+    ScalarizedCalls++;
+  }
+
+  return !decisions.empty();
+}
+
+void CloneScalarizeArgs::findScalarizableArgs(Module &M) {
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration() || F->mayBeOverridden() || F->isVarArg() || F->use_empty()) continue;
+
+    for (Function::arg_iterator A = F->arg_begin(), AE = F->arg_end(); A != AE; ++A) {
+      std::vector<unsigned> read;
+      if (!isReadFieldByField(A, read)) continue;
+
+      fields[A] = read;
+      ScalarizableArgs++;
+    }
+  }
+}
+
+// Whether A points to a struct whose scalar fields are only loaded, and
+// which fields are
+bool CloneScalarizeArgs::isReadFieldByField(Argument *A, std::vector<unsigned> &read) {
+  PointerType *PT = dyn_cast<PointerType>(A->getType());
+  StructType *ST = PT ? dyn_cast<StructType>(PT->getElementType()) : 0;
+  if (!ST || ST->isOpaque() || A->hasNestAttr() || A->use_empty()) return false;
+
+  std::set<unsigned> loaded;
+  for (Value::use_iterator UI = A->use_begin(), E = A->use_end(); UI != E; ++UI) {
+    GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(*UI);
+    if (!GEP || GEP->getNumIndices() != 2) return false;
+
+    ConstantInt *zero  = dyn_cast<ConstantInt>(GEP->getOperand(1));
+    ConstantInt *field = dyn_cast<ConstantInt>(GEP->getOperand(2));
+    if (!zero || !zero->isZero() || !field) return false;
+
+    unsigned idx = field->getZExtValue();
+    Type *FieldTy = ST->getElementType(idx);
+    if (!FieldTy->isSingleValueType()) return false;
+
+    for (Value::use_iterator LI = GEP->use_begin(), LE = GEP->use_end(); LI != LE; ++LI) {
+      LoadInst *L = dyn_cast<LoadInst>(*LI);
+      if (!L || !L->isSimple() || L->getType() != FieldTy) return false;
+    }
+    loaded.insert(idx);
+  }
+
+  if (loaded.empty() || loaded.size() > ScalarizeMaxFields) return false;
+  read.assign(loaded.begin(), loaded.end());
+  return true;
+}
+
+// Whether the caller of CS may load the fields of the struct it passes to A
+// before the call, and get what the callee would: the struct is an alloca
+// or a global of its own, and nothing the callee writes may be it
+bool CloneScalarizeArgs::isUnchangedDuringCall(CallSite CS, Argument *A) {
+  StructType *ST = cast<StructType>(cast<PointerType>(A->getType())->getElementType());
+  Value *O = CS.getArgument(A->getArgNo())->stripPointerCasts();
+
+  if (AllocaInst *AI = dyn_cast<AllocaInst>(O)) {
+    if (AI->getAllocatedType() != ST || AI->isArrayAllocation()) return false;
+  } else if (GlobalVariable *GV = dyn_cast<GlobalVariable>(O)) {
+    if (GV->getType()->getElementType() != ST || GV->hasExternalWeakLinkage()) return false;
+  } else {
+    return false;
+  }
+
+  const FunctionModRef &S = modRef.get(A->getParent());
+  if (S.writesAny()) return false;
+
+  for (std::set<const Value*>::const_iterator W = S.written.begin(); W != S.written.end(); ++W) {
+    const Value *object = *W;
+    if (const Argument *B = dyn_cast<Argument>(object)) {
+      object = GetUnderlyingObject(CS.getArgument(B->getArgNo()));
+    }
+    if (ModRefSummary::mayAlias(object, O)) return false;
+  }
+
+  return true;
+}
+
+// Clone of F that takes the fields it reads from args instead of pointers
+// to their structs
+Function* CloneScalarizeArgs::getScalarizedClone(Function *F, const std::vector<unsigned> &args) {
+  std::pair<Function*, std::vector<unsigned> > key(F, args);
+  std::map<std::pair<Function*, std::vector<unsigned> >, Function*>::iterator it = clones.find(key);
+  if (it != clones.end()) return it->second;
+
+  std::vector<Type*> params;
+  std::vector<unsigned> widths;
+  std::string signature;
+  for (Function::arg_iterator A = F->arg_begin(), E = F->arg_end(); A != E; ++A) {
+    if (std::find(args.begin(), args.end(), A->getArgNo()) == args.end()) {
+      params.push_back(A->getType());
+      widths.push_back(1);
+      continue;
+    }
+
+    StructType *ST = cast<StructType>(cast<PointerType>(A->getType())->getElementType());
+    const std::vector<unsigned> &read = fields[A];
+    signature += utostr(A->getArgNo()) + ":";
+    for (unsigned i = 0; i < read.size(); ++i) {
+      params.push_back(ST->getElementType(read[i]));
+      signature += utostr(read[i]) + ",";
+    }
+    signature += ";";
+    widths.push_back(read.size());
+  }
+  FunctionType *NFTy = FunctionType::get(F->getReturnType(), params, false);
+
+  std::string name = getCloneName(F->getName(), ".scalar", signature);
+  Function *NF = F->getParent()->getFunction(name);
+  if (NF && NF->getFunctionType() == NFTy) {
+    clones[key] = NF;
+    return NF;
+  }
+
+  // Clone the body, then move it into a function of the new type
+  ValueToValueMapTy VMap;
+  Function *Body = CloneFunction(F, VMap, false);
+
+  NF = Function::Create(NFTy, getCloneLinkage(F), name);
+  NF->copyAttributesFrom(F);
+  NF->setAttributes(remapAttributes(F->getAttributes(), F->getContext(), widths));
+  F->getParent()->getFunctionList().insert(F, NF);
+  NF->getBasicBlockList().splice(NF->begin(), Body->getBasicBlockList());
+
+  Function::arg_iterator NA = NF->arg_begin();
+  for (Function::arg_iterator A = Body->arg_begin(), E = Body->arg_end(); A != E; ++A) {
+    if (std::find(args.begin(), args.end(), A->getArgNo()) == args.end()) {
+      A->replaceAllUsesWith(NA);
+      NA->takeName(A);
+      ++NA;
+      continue;
+    }
+
+    std::map<unsigned, Argument*> fieldArgs;
+    const std::vector<unsigned> &read = fields[getArgument(F, A->getArgNo())];
+    for (unsigned i = 0; i < read.size(); ++i, ++NA) {
+      NA->setName(A->getName() + "." + utostr(read[i]));
+      fieldArgs[read[i]] = NA;
+    }
+
+    std::vector<GetElementPtrInst*> geps;
+    for (Value::use_iterator UI = A->use_begin(), UE = A->use_end(); UI != UE; ++UI) {
+      geps.push_back(cast<GetElementPtrInst>(*UI));
+    }
+    for (unsigned i = 0; i < geps.size(); ++i) {
+      Argument *field = fieldArgs[cast<ConstantInt>(geps[i]->getOperand(2))->getZExtValue()];
+      while (!geps[i]->use_empty()) {
+        LoadInst *L = cast<LoadInst>(geps[i]->use_back());
+        L->replaceAllUsesWith(field);
+        L->eraseFromParent();
+      }
+      geps[i]->eraseFromParent();
+    }
+    ScalarizedFields += read.size();
+  }
+  delete Body;
+
+  ScalarizedClones++;
+  clones[key] = NF;
+  return NF;
+}
+
+// Replace Call by a call to NF that loads the fields of args before it
+void CloneScalarizeArgs::rewriteCall(Instruction *Call, Function *NF, const std::vector<unsigned> &args) {
+  CallSite CS(Call);
+  Function *F = CS.getCalledFunction();
+  IRBuilder<> Builder(Call);
+
+  std::vector<Value*> actuals;
+  std::vector<unsigned> widths;
+  for (unsigned i = 0; i < CS.arg_size(); ++i) {
+    Value *actual = CS.getArgument(i);
+    if (std::find(args.begin(), args.end(), i) == args.end()) {
+      actuals.push_back(actual);
+      widths.push_back(1);
+      continue;
+    }
+
+    const std::vector<unsigned> &read = fields[getArgument(F, i)];
+    for (unsigned j = 0; j < read.size(); ++j) {
+      Value *ptr = Builder.CreateStructGEP(actual, read[j]);
+      actuals.push_back(Builder.CreateLoad(ptr, actual->getName() + "." + utostr(read[j])));
+    }
+    widths.push_back(read.size());
+  }
+
+  AttributeSet attrs = remapAttributes(CS.getAttributes(), Call->getContext(), widths);
+  Instruction *NC;
+  if (InvokeInst *II = dyn_cast<InvokeInst>(Call)) {
+    NC = InvokeInst::Create(NF, II->getNormalDest(), II->getUnwindDest(), actuals, "", Call);
+    cast<InvokeInst>(NC)->setCallingConv(II->getCallingConv());
+    cast<InvokeInst>(NC)->setAttributes(attrs);
+  } else {
+    CallInst *CI = cast<CallInst>(Call);
+    NC = CallInst::Create(NF, actuals, "", Call);
+    cast<CallInst>(NC)->setTailCall(CI->isTailCall());
+    cast<CallInst>(NC)->setCallingConv(CI->getCallingConv());
+    cast<CallInst>(NC)->setAttributes(attrs);
+  }
+  NC->setDebugLoc(Call->getDebugLoc());
+
+  if (!Call->use_empty()) Call->replaceAllUsesWith(NC);
+  NC->takeName(Call);
+  Call->eraseFromParent();
+}
+
+void CloneScalarizeArgs::print(raw_ostream& O, const Module* M) const {
+  O << "Number of struct arguments only read field by field: " << ScalarizableArgs << '\n';
+  O << "Number of calls redirected to scalarized clones: " << ScalarizedCalls << '\n';
+  O << "Number of scalarized clones: " << ScalarizedClones << '\n';
+  O << "Number of fields passed as scalars: " << ScalarizedFields << '\n';
+  budget.print(O);
+}
+
+// Register the pass to the LLVM framework
+char CloneScalarizeArgs::ID = 0;
+static RegisterPass<CloneScalarizeArgs> X("clone-scalarize-args", "Clone functions to take the fields of struct arguments they read.", false, false);
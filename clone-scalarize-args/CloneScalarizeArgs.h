@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "../utils/CloneNaming.h"
+#include "../utils/CompileBudget.h"
+#include "../utils/ModRefSummary.h"
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "clone-scalarize-args"
+namespace llvm {
+  STATISTIC(ScalarizableArgs,  "Number of struct arguments only read field by field");
+  STATISTIC(ScalarizedCalls,   "Number of calls redirected to scalarized clones");
+  STATISTIC(ScalarizedClones,  "Number of scalarized clones");
+  STATISTIC(ScalarizedFields,  "Number of fields passed as scalars");
+
+  // Clones functions that take a pointer to a struct and only load some of
+  // its fields, so the fields are passed instead of the pointer. A call is
+  // redirected when the callee, per its mod/ref summary, cannot write the
+  // struct while it runs, and the struct is an alloca or a global the caller
+  // can load from itself. Clones are shared by the calls that scalarize the
+  // same arguments.
+  class CloneScalarizeArgs : public ModulePass {
+
+    // A call and the arguments it passes field by field
+    struct Decision {
+      Instruction *call;
+      std::vector<unsigned> args;
+    };
+
+    CompileBudget budget;
+    ModRefSummary modRef;
+
+    // Fields each struct argument is read from, in order
+    std::map<Argument*, std::vector<unsigned> > fields;
+
+    std::map<std::pair<Function*, std::vector<unsigned> >, Function*> clones;
+
+    void findScalarizableArgs(Module &M);
+    bool isReadFieldByField(Argument *A, std::vector<unsigned> &read);
+    bool isUnchangedDuringCall(CallSite CS, Argument *A);
+    Function* getScalarizedClone(Function *F, const std::vector<unsigned> &args);
+    void rewriteCall(Instruction *Call, Function *NF, const std::vector<unsigned> &args);
+
+   public:
+
+    static char ID;
+
+    CloneScalarizeArgs();
+    bool runOnModule(Module &M);
+    virtual void print(raw_ostream& O, const Module* M) const;
+  };
+}
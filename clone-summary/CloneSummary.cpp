@@ -0,0 +1,350 @@
+#include "CloneSummary.h"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+SummaryOut("clone-summary-out", cl::init(""),
+           cl::desc("File to write the module summary to (default: <module>.cbosum)"));
+
+static cl::opt<std::string>
+SummaryList("clone-summary-list", cl::init(""),
+            cl::desc("File listing the module summaries, one per line"));
+
+static cl::opt<std::string>
+DecisionsFile("clone-decisions", cl::init("clone-decisions.txt"),
+              cl::desc("File with the clone decisions"));
+
+static cl::opt<unsigned>
+MaxCloneSize("clone-summary-max-size", cl::init(500),
+             cl::desc("Largest function, in instructions, cloned across modules"));
+
+static cl::opt<unsigned>
+MaxClonesPerFunction("clone-summary-max-clones", cl::init(4),
+                     cl::desc("Maximum number of constant argument clones per function"));
+
+// ----------------------------------------------------------------------- //
+
+CloneSummaryWriter::CloneSummaryWriter() : ModulePass(ID) {
+  SummarizedFunctions = 0;
+  SummarizedCalls     = 0;
+}
+
+bool CloneSummaryWriter::runOnModule(Module &M) {
+  ModuleSummary S;
+  S.module = M.getModuleIdentifier();
+
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+
+    // The body of an overridable function may not be the one that runs
+    if (summarizable(F) && !F->mayBeOverridden() && !F->hasAvailableExternallyLinkage()) {
+      S.functions.push_back(summarizeFunction(F));
+      SummarizedFunctions++;
+    }
+
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+      for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+        CallSite CS(I);
+        if (!CS) continue;
+        Function *callee = CS.getCalledFunction();
+        if (!callee || !summarizable(callee) || CS.arg_size() != callee->arg_size()) continue;
+
+        S.calls.push_back(summarizeCallSite(CS));
+        SummarizedCalls++;
+      }
+    }
+  }
+
+  std::string fileName = SummaryOut.empty() ? M.getModuleIdentifier() + ".cbosum" : SummaryOut;
+  std::string error;
+  raw_fd_ostream out(fileName.c_str(), error);
+  if (!error.empty()) {
+    errs() << "clone-summary: cannot write " << fileName << ": " << error << "\n";
+    return false;
+  }
+  S.write(out);
+
+  return false;
+}
+
+// ----------------------------------------------------------------------- //
+
+CloneDecider::CloneDecider() : ModulePass(ID) {
+  DecidedClones = 0;
+}
+
+bool CloneDecider::runOnModule(Module &M) {
+  std::ifstream list(SummaryList.c_str());
+  if (!list) {
+    errs() << "clone-decide: cannot read summary list " << SummaryList << "\n";
+    return false;
+  }
+
+  // Summaries are folded into the aggregate one at a time, so memory is
+  // bounded by the aggregate and not by the number of modules.
+  std::string fileName;
+  while (std::getline(list, fileName)) {
+    if (fileName.empty()) continue;
+    std::ifstream in(fileName.c_str());
+    ModuleSummary S;
+    if (!in || !S.read(in)) {
+      errs() << "clone-decide: ignoring malformed summary " << fileName << "\n";
+      continue;
+    }
+    addSummary(S);
+  }
+
+  std::vector<CloneDecision> result;
+  decide(M, result);
+
+  std::string error;
+  raw_fd_ostream out(DecisionsFile.c_str(), error);
+  if (!error.empty()) {
+    errs() << "clone-decide: cannot write " << DecisionsFile << ": " << error << "\n";
+    return false;
+  }
+  for (std::vector<CloneDecision>::iterator it = result.begin(); it != result.end(); ++it) {
+    out << it->str() << "\n";
+  }
+
+  return false;
+}
+
+void CloneDecider::addSummary(const ModuleSummary &S) {
+  for (std::vector<FunctionSummary>::const_iterator it = S.functions.begin(); it != S.functions.end(); ++it) {
+    if (!definitions.count(it->name)) definitions[it->name] = *it;
+  }
+
+  for (std::vector<CallSiteSummary>::const_iterator it = S.calls.begin(); it != S.calls.end(); ++it) {
+    std::vector< std::pair<unsigned, ArgSummary> > constants = it->constants();
+    if (!constants.empty()) constantCalls[it->callee][constants]++;
+    if (it->hasDisjointPointerArgs()) noaliasCallees.insert(it->callee);
+  }
+}
+
+static bool moreCalls(const std::pair<std::vector< std::pair<unsigned, ArgSummary> >, unsigned> &A,
+                      const std::pair<std::vector< std::pair<unsigned, ArgSummary> >, unsigned> &B) {
+  if (A.second != B.second) return A.second > B.second;
+  return A.first < B.first;
+}
+
+// Pick, for every small enough function, the constant argument combinations
+// with more calls. Clone names are a hash of the specialization, so every
+// module sees the same names, and clone-constant-args names the clones of
+// the same specialization the same.
+void CloneDecider::decide(Module &M, std::vector<CloneDecision> &decisions) {
+  typedef std::vector< std::pair<unsigned, ArgSummary> > ConstantsTy;
+
+  for (std::map<std::string, std::map<ConstantsTy, unsigned> >::iterator it = constantCalls.begin();
+      it != constantCalls.end(); ++it) {
+    if (!definitions.count(it->first)) continue;
+    if (definitions[it->first].size > MaxCloneSize) continue;
+
+    std::vector< std::pair<ConstantsTy, unsigned> > candidates(it->second.begin(), it->second.end());
+    std::sort(candidates.begin(), candidates.end(), moreCalls);
+    if (candidates.size() > MaxClonesPerFunction) candidates.resize(MaxClonesPerFunction);
+
+    std::set<ConstantsTy> selected;
+    for (unsigned i = 0; i < candidates.size(); ++i) {
+      selected.insert(candidates[i].first);
+    }
+
+    for (std::set<ConstantsTy>::iterator sit = selected.begin(); sit != selected.end(); ++sit) {
+      CloneDecision D;
+      D.kind      = CloneDecision::ConstArgs;
+      D.callee    = it->first;
+      D.constants = *sit;
+
+      // Signatures leave the type out, so any pointer type will do for null
+      std::string signature;
+      for (ConstantsTy::const_iterator cit = sit->begin(); cit != sit->end(); ++cit) {
+        Type *Ty = cit->second.kind == ArgSummary::ConstInt
+                 ? (Type*)IntegerType::get(M.getContext(), cit->second.bits)
+                 : (Type*)Type::getInt8PtrTy(M.getContext());
+        appendConstantSignature(signature, cit->first, getArgConstant(cit->second, Ty), &M);
+      }
+      D.clone = getCloneName(it->first, ".constargs", signature);
+      decisions.push_back(D);
+      DecidedClones++;
+    }
+  }
+
+  for (std::set<std::string>::iterator it = noaliasCallees.begin(); it != noaliasCallees.end(); ++it) {
+    if (!definitions.count(*it)) continue;
+    if (definitions[*it].size > MaxCloneSize) continue;
+
+    CloneDecision D;
+    D.kind   = CloneDecision::NoAlias;
+    D.callee = *it;
+    D.clone  = *it + ".noalias";
+    decisions.push_back(D);
+    DecidedClones++;
+  }
+}
+
+// ----------------------------------------------------------------------- //
+
+CloneApplier::CloneApplier() : ModulePass(ID) {
+  AppliedClones = 0;
+  AppliedCalls  = 0;
+}
+
+bool CloneApplier::runOnModule(Module &M) {
+  std::vector<CloneDecision> all;
+  if (!readDecisions(DecisionsFile, all)) {
+    errs() << "clone-apply: cannot read decisions " << DecisionsFile << "\n";
+    return false;
+  }
+  for (std::vector<CloneDecision>::iterator it = all.begin(); it != all.end(); ++it) {
+    decisions[it->callee].push_back(*it);
+  }
+
+  bool modified = false;
+
+  // Define the clones of the functions this module defines
+  std::vector<Function*> defined;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration() || !summarizable(F) || F->mayBeOverridden()) continue;
+    if (F->hasAvailableExternallyLinkage()) continue;
+    if (decisions.count(F->getName())) defined.push_back(F);
+  }
+  for (std::vector<Function*>::iterator it = defined.begin(); it != defined.end(); ++it) {
+    std::vector<CloneDecision> &fnDecisions = decisions[(*it)->getName()];
+    for (std::vector<CloneDecision>::iterator dit = fnDecisions.begin(); dit != fnDecisions.end(); ++dit) {
+      if (M.getFunction(dit->clone)) continue;
+      if (createClone(*it, *dit)) {
+        AppliedClones++;
+        modified = true;
+      }
+    }
+  }
+
+  // Redirect the calls, whether the clone is defined here or not
+  std::vector<CallSite> calls;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+      for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+        CallSite CS(I);
+        if (!CS) continue;
+        Function *callee = CS.getCalledFunction();
+        if (!callee || !summarizable(callee) || !decisions.count(callee->getName())) continue;
+        calls.push_back(CS);
+      }
+    }
+  }
+
+  for (std::vector<CallSite>::iterator it = calls.begin(); it != calls.end(); ++it) {
+    CallSite CS = *it;
+    Function *callee = CS.getCalledFunction();
+    if (CS.arg_size() != callee->arg_size()) continue;
+
+    const CloneDecision *D = selectDecision(summarizeCallSite(CS));
+    if (!D) continue;
+
+    Function *NF = getCloneDeclaration(callee, *D);
+    if (!NF || NF == CS.getInstruction()->getParent()->getParent()) continue;
+    CS.setCalledFunction(NF);
+    AppliedCalls++;
+    modified = true;
+  }
+
+  return modified;
+}
+
+// Prefer the constant argument clone that fixes more arguments, and fall
+// back to the noalias clone.
+const CloneDecision* CloneApplier::selectDecision(const CallSiteSummary &CS) {
+  std::vector<CloneDecision> &fnDecisions = decisions[CS.callee];
+  const CloneDecision *best = 0;
+  for (std::vector<CloneDecision>::iterator it = fnDecisions.begin(); it != fnDecisions.end(); ++it) {
+    if (!it->matches(CS)) continue;
+    if (!best) {
+      best = &*it;
+    } else if (it->kind == CloneDecision::ConstArgs &&
+               (best->kind == CloneDecision::NoAlias || it->constants.size() > best->constants.size())) {
+      best = &*it;
+    }
+  }
+  return best;
+}
+
+Function* CloneApplier::getCloneDeclaration(Function *Fn, const CloneDecision &D) {
+  Module *M = Fn->getParent();
+  if (Function *NF = M->getFunction(D.clone)) {
+    return NF->getFunctionType() == Fn->getFunctionType() ? NF : 0;
+  }
+
+  Function *NF = Function::Create(Fn->getFunctionType(), GlobalValue::ExternalLinkage, D.clone, M);
+  NF->copyAttributesFrom(Fn);
+  return NF;
+}
+
+// Define the clone of the given function described by the decision. The
+// clone keeps the linkage of the original, so an original that may be
+// defined in several modules gets clones that may be too.
+Function* CloneApplier::createClone(Function *Fn, const CloneDecision &D) {
+
+  // Make sure every constant fits its formal before touching the module
+  std::map<unsigned, Constant*> constants;
+  for (std::vector< std::pair<unsigned, ArgSummary> >::const_iterator it = D.constants.begin();
+      it != D.constants.end(); ++it) {
+    if (it->first >= Fn->arg_size()) return 0;
+    Function::arg_iterator Arg = Fn->arg_begin();
+    std::advance(Arg, it->first);
+    Constant *C = getArgConstant(it->second, Arg->getType());
+    if (!C) return 0;
+    constants[it->first] = C;
+  }
+
+  Function *NF = Function::Create(Fn->getFunctionType(), Fn->getLinkage());
+  NF->copyAttributesFrom(Fn);
+
+  Function::arg_iterator NFArg = NF->arg_begin();
+  for (Function::arg_iterator Arg = Fn->arg_begin(), ArgEnd = Fn->arg_end(); Arg != ArgEnd; ++Arg, ++NFArg) {
+    NFArg->setName(Arg->getName());
+
+    if (D.kind == CloneDecision::NoAlias && NFArg->getType()->isPointerTy()) {
+      AttrBuilder noalias(Attribute::get(NFArg->getContext(), Attribute::NoAlias));
+      int argNo = NFArg->getArgNo() + 1;
+      NFArg->addAttr(AttributeSet::get(NFArg->getContext(), argNo, noalias));
+    }
+  }
+
+  NF->setName(D.clone);
+
+  // fill clone content
+  ValueToValueMapTy VMap;
+  SmallVector<ReturnInst*, 8> Returns;
+  Function::arg_iterator NI = NF->arg_begin();
+  for (Function::arg_iterator I = Fn->arg_begin(); NI != NF->arg_end(); ++I, ++NI) {
+    VMap[I] = NI;
+  }
+  CloneAndPruneFunctionInto(NF, Fn, VMap, false, Returns);
+
+  // Replace uses from constant args
+  for (std::map<unsigned, Constant*>::iterator it = constants.begin(); it != constants.end(); ++it) {
+    Function::arg_iterator Arg = NF->arg_begin();
+    std::advance(Arg, it->first);
+    Arg->replaceAllUsesWith(it->second);
+  }
+
+  // Insert the clone function before the original
+  Fn->getParent()->getFunctionList().insert(Fn, NF);
+
+  return NF;
+}
+
+void CloneApplier::print(raw_ostream& O, const Module* M) const {
+  O << "# clones; # replaced calls\n";
+  O << AppliedClones << ";" << AppliedCalls << "\n";
+}
+
+// Register the passes to the LLVM framework
+char CloneSummaryWriter::ID = 0;
+static RegisterPass<CloneSummaryWriter> X("clone-summary", "Write a summary for cross-module cloning.", false, false);
+
+char CloneDecider::ID = 0;
+static RegisterPass<CloneDecider> Y("clone-decide", "Decide cross-module clones from summaries.", false, false);
+
+char CloneApplier::ID = 0;
+static RegisterPass<CloneApplier> Z("clone-apply", "Create and use cross-module clones.", false, false);
@@ -0,0 +1,84 @@
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <iterator>
+
+#include "llvm/Pass.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "../utils/CloneNaming.h"
+#include "ModuleSummary.h"
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "clone-summary"
+namespace llvm {
+  STATISTIC(SummarizedFunctions, "Number of summarized functions");
+  STATISTIC(SummarizedCalls,     "Number of summarized calls");
+  STATISTIC(DecidedClones,       "Number of clones decided");
+  STATISTIC(AppliedClones,       "Number of clones created");
+  STATISTIC(AppliedCalls,        "Number of replaced calls");
+
+  // Writes the summary of a module. Runs on each module independently.
+  class CloneSummaryWriter : public ModulePass {
+   public:
+
+    static char ID;
+
+    CloneSummaryWriter();
+    bool runOnModule(Module &M);
+  };
+
+  // Reads the summaries of all modules and decides which clones should be
+  // created. Does not look at the module it runs on, so it may be run on an
+  // empty one.
+  class CloneDecider : public ModulePass {
+
+    // Externally visible function definitions, by name
+    std::map<std::string, FunctionSummary> definitions;
+
+    // Number of calls for every constant argument combination, by callee
+    std::map<std::string, std::map< std::vector< std::pair<unsigned, ArgSummary> >, unsigned> > constantCalls;
+
+    // Callees called with disjoint pointer arguments
+    std::set<std::string> noaliasCallees;
+
+    void addSummary(const ModuleSummary &S);
+    void decide(Module &M, std::vector<CloneDecision> &decisions);
+
+   public:
+
+    static char ID;
+
+    CloneDecider();
+    bool runOnModule(Module &M);
+  };
+
+  // Creates the clones decided for the functions defined in the module and
+  // redirects the module calls that match a decision.
+  class CloneApplier : public ModulePass {
+
+    std::map<std::string, std::vector<CloneDecision> > decisions;
+
+    Function* createClone(Function *Fn, const CloneDecision &D);
+    Function* getCloneDeclaration(Function *Fn, const CloneDecision &D);
+    const CloneDecision* selectDecision(const CallSiteSummary &CS);
+
+   public:
+
+    static char ID;
+
+    CloneApplier();
+    bool runOnModule(Module &M);
+    virtual void print(raw_ostream& O, const Module* M) const;
+  };
+}
@@ -0,0 +1,306 @@
+#include <fstream>
+#include <sstream>
+#include <set>
+
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "ModuleSummary.h"
+
+using namespace llvm;
+
+bool ArgSummary::operator==(const ArgSummary &O) const {
+  return kind == O.kind && bits == O.bits && value == O.value &&
+         object == O.object && global == O.global;
+}
+
+bool ArgSummary::operator<(const ArgSummary &O) const {
+  if (kind != O.kind) return kind < O.kind;
+  if (bits != O.bits) return bits < O.bits;
+  if (value != O.value) return value < O.value;
+  if (object != O.object) return object < O.object;
+  return global < O.global;
+}
+
+std::string ArgSummary::str() const {
+  std::stringstream S;
+  switch (kind) {
+    case Unknown:     S << "?"; break;
+    case UnknownPtr:  S << "p?"; break;
+    case ConstInt:    S << "i" << bits << ":" << value; break;
+    case Null:        S << "null"; break;
+    case LocalObject: S << "obj:" << object; break;
+    case Global:      S << "@" << global; break;
+  }
+  return S.str();
+}
+
+bool ArgSummary::parse(const std::string &S, ArgSummary &A) {
+  A = ArgSummary();
+  if (S == "?") {
+    A.kind = Unknown;
+  } else if (S == "p?") {
+    A.kind = UnknownPtr;
+  } else if (S == "null") {
+    A.kind = Null;
+  } else if (S.compare(0, 4, "obj:") == 0) {
+    A.kind = LocalObject;
+    std::istringstream in(S.substr(4));
+    if (!(in >> A.object)) return false;
+  } else if (S.size() > 1 && S[0] == '@') {
+    A.kind = Global;
+    A.global = S.substr(1);
+  } else if (S.size() > 1 && S[0] == 'i') {
+    size_t colon = S.find(':');
+    if (colon == std::string::npos) return false;
+    A.kind = ConstInt;
+    std::istringstream bits(S.substr(1, colon - 1));
+    std::istringstream value(S.substr(colon + 1));
+    if (!(bits >> A.bits) || !(value >> A.value)) return false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::vector< std::pair<unsigned, ArgSummary> > CallSiteSummary::constants() const {
+  std::vector< std::pair<unsigned, ArgSummary> > result;
+  for (unsigned i = 0; i < args.size(); ++i) {
+    if (args[i].isConstant()) result.push_back(std::make_pair(i, args[i]));
+  }
+  return result;
+}
+
+bool CallSiteSummary::hasDisjointPointerArgs() const {
+  std::set<unsigned> objects;
+  for (unsigned i = 0; i < args.size(); ++i) {
+    if (!args[i].isPointer()) continue;
+    if (args[i].kind != ArgSummary::LocalObject) return false;
+    if (!objects.insert(args[i].object).second) return false;
+  }
+  return objects.size() > 1;
+}
+
+void ModuleSummary::write(raw_ostream &O) const {
+  O << "module " << module << "\n";
+  for (std::vector<FunctionSummary>::const_iterator it = functions.begin(); it != functions.end(); ++it) {
+    O << "function " << it->name << " " << it->size << " " << it->numArgs << "\n";
+  }
+  for (std::vector<CallSiteSummary>::const_iterator it = calls.begin(); it != calls.end(); ++it) {
+    O << "call " << it->caller << " " << it->callee << " " << it->args.size();
+    for (unsigned i = 0; i < it->args.size(); ++i) {
+      O << " " << it->args[i].str();
+    }
+    O << "\n";
+  }
+}
+
+bool ModuleSummary::read(std::istream &in) {
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream S(line);
+    std::string tag;
+    if (!(S >> tag)) continue;
+
+    if (tag == "module") {
+      S >> module;
+    } else if (tag == "function") {
+      FunctionSummary FS;
+      if (!(S >> FS.name >> FS.size >> FS.numArgs)) return false;
+      functions.push_back(FS);
+    } else if (tag == "call") {
+      CallSiteSummary CS;
+      unsigned numArgs;
+      if (!(S >> CS.caller >> CS.callee >> numArgs)) return false;
+      for (unsigned i = 0; i < numArgs; ++i) {
+        std::string arg;
+        ArgSummary A;
+        if (!(S >> arg) || !ArgSummary::parse(arg, A)) return false;
+        CS.args.push_back(A);
+      }
+      calls.push_back(CS);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CloneDecision::matches(const CallSiteSummary &CS) const {
+  if (CS.callee != callee) return false;
+  if (kind == NoAlias) return CS.hasDisjointPointerArgs();
+
+  for (std::vector< std::pair<unsigned, ArgSummary> >::const_iterator it = constants.begin();
+      it != constants.end(); ++it) {
+    if (it->first >= CS.args.size()) return false;
+    if (!(CS.args[it->first] == it->second)) return false;
+  }
+  return true;
+}
+
+std::string CloneDecision::str() const {
+  std::stringstream S;
+  if (kind == NoAlias) {
+    S << "noalias " << callee << " " << clone;
+  } else {
+    S << "constargs " << callee << " " << clone << " " << constants.size();
+    for (unsigned i = 0; i < constants.size(); ++i) {
+      S << " " << constants[i].first << " " << constants[i].second.str();
+    }
+  }
+  return S.str();
+}
+
+bool CloneDecision::parse(const std::string &line, CloneDecision &D) {
+  std::istringstream S(line);
+  std::string tag;
+  if (!(S >> tag >> D.callee >> D.clone)) return false;
+
+  D.constants.clear();
+  if (tag == "noalias") {
+    D.kind = NoAlias;
+    return true;
+  }
+  if (tag != "constargs") return false;
+
+  D.kind = ConstArgs;
+  unsigned size;
+  if (!(S >> size)) return false;
+  for (unsigned i = 0; i < size; ++i) {
+    unsigned idx;
+    std::string arg;
+    ArgSummary A;
+    if (!(S >> idx >> arg) || !ArgSummary::parse(arg, A)) return false;
+    D.constants.push_back(std::make_pair(idx, A));
+  }
+  return true;
+}
+
+bool llvm::readDecisions(const std::string &fileName, std::vector<CloneDecision> &decisions) {
+  std::ifstream in(fileName.c_str());
+  if (!in) return false;
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty()) continue;
+    CloneDecision D;
+    if (!CloneDecision::parse(line, D)) return false;
+    decisions.push_back(D);
+  }
+  return true;
+}
+
+// Only externally visible functions are summarized, since local names
+// are not unique across modules. Names are written as whitespace
+// separated tokens, so anything that would break the format is skipped.
+bool llvm::summarizable(const Function *F) {
+  if (F->hasLocalLinkage() || F->isIntrinsic() || !F->hasName()) return false;
+  StringRef name = F->getName();
+  return name.find_first_of(" \t\r\n") == StringRef::npos;
+}
+
+FunctionSummary llvm::summarizeFunction(const Function *F) {
+  FunctionSummary FS;
+  FS.name    = F->getName();
+  FS.numArgs = F->arg_size();
+  for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+    FS.size += BB->size();
+  }
+  return FS;
+}
+
+static bool isAllocation(const Value *V) {
+  if (isa<AllocaInst>(V)) return true;
+  ImmutableCallSite CS(V);
+  if (!CS) return false;
+  const Function *F = CS.getCalledFunction();
+  return F && (F->getName() == "malloc" || F->getName() == "calloc");
+}
+
+// A local object does not escape if the only thing done with its address,
+// other than memory accesses, is passing it to the given call site.
+static bool doesNotEscape(const Value *Obj, const Instruction *site) {
+  std::vector<const Value*> worklist;
+  std::set<const Value*> visited;
+  worklist.push_back(Obj);
+
+  while (!worklist.empty()) {
+    const Value *V = worklist.back();
+    worklist.pop_back();
+    if (!visited.insert(V).second) continue;
+
+    for (Value::const_use_iterator UI = V->use_begin(), E = V->use_end(); UI != E; ++UI) {
+      const User *U = *UI;
+      if (isa<GetElementPtrInst>(U) || isa<BitCastInst>(U)) {
+        worklist.push_back(U);
+      } else if (isa<LoadInst>(U) || isa<ICmpInst>(U)) {
+        continue;
+      } else if (const StoreInst *SI = dyn_cast<StoreInst>(U)) {
+        if (SI->getValueOperand() == V) return false;
+      } else if (U == site) {
+        continue;
+      } else if (ImmutableCallSite CS = ImmutableCallSite(U)) {
+        const Function *F = CS.getCalledFunction();
+        if (!F || F->getName() != "free") return false;
+      } else {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+CallSiteSummary llvm::summarizeCallSite(CallSite CS) {
+  CallSiteSummary summary;
+  Instruction *I = CS.getInstruction();
+  Function *caller = I->getParent()->getParent();
+  summary.caller = caller->hasName() && caller->getName().find_first_of(" \t\r\n") == StringRef::npos ?
+                   caller->getName().str() : std::string("-");
+  if (Function *F = CS.getCalledFunction()) summary.callee = F->getName();
+
+  std::map<Value*, unsigned> objects;
+  for (CallSite::arg_iterator AI = CS.arg_begin(), E = CS.arg_end(); AI != E; ++AI) {
+    Value *V = *AI;
+    ArgSummary A;
+
+    if (ConstantInt *CI = dyn_cast<ConstantInt>(V)) {
+      if (CI->getBitWidth() <= 64) {
+        A.kind  = ArgSummary::ConstInt;
+        A.bits  = CI->getBitWidth();
+        A.value = CI->getSExtValue();
+      }
+    } else if (isa<ConstantPointerNull>(V)) {
+      A.kind = ArgSummary::Null;
+    } else if (V->getType()->isPointerTy()) {
+      A.kind = ArgSummary::UnknownPtr;
+      Value *Obj = GetUnderlyingObject(V, 0);
+      if (GlobalValue *GV = dyn_cast<GlobalValue>(Obj)) {
+        if (GV->hasName() && GV->getName().find_first_of(" \t\r\n") == StringRef::npos) {
+          A.kind   = ArgSummary::Global;
+          A.global = GV->getName();
+        }
+      } else if (isAllocation(Obj) && doesNotEscape(Obj, I)) {
+        if (!objects.count(Obj)) {
+          unsigned id = objects.size();
+          objects[Obj] = id;
+        }
+        A.kind   = ArgSummary::LocalObject;
+        A.object = objects[Obj];
+      }
+    }
+
+    summary.args.push_back(A);
+  }
+  return summary;
+}
+
+Constant* llvm::getArgConstant(const ArgSummary &A, Type *Ty) {
+  if (A.kind == ArgSummary::Null) {
+    if (PointerType *PTy = dyn_cast<PointerType>(Ty)) return ConstantPointerNull::get(PTy);
+  } else if (A.kind == ArgSummary::ConstInt) {
+    IntegerType *ITy = dyn_cast<IntegerType>(Ty);
+    if (ITy && ITy->getBitWidth() == A.bits) return ConstantInt::getSigned(ITy, A.value);
+  }
+  return 0;
+}
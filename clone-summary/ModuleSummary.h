@@ -0,0 +1,106 @@
+#ifndef CLONE_SUMMARY_MODULE_SUMMARY_H
+#define CLONE_SUMMARY_MODULE_SUMMARY_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <istream>
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace llvm {
+
+  // What a summary knows about one actual argument of a call site.
+  struct ArgSummary {
+    enum Kind {
+      Unknown,      // non-pointer value we know nothing about
+      UnknownPtr,   // pointer we know nothing about
+      ConstInt,     // integer constant of at most 64 bits
+      Null,         // null pointer constant
+      LocalObject,  // pointer into an alloca or malloc that does not escape
+      Global        // pointer into a global
+    };
+
+    Kind kind;
+    unsigned bits;      // ConstInt: width of the integer
+    int64_t value;      // ConstInt: sign extended value
+    unsigned object;    // LocalObject: object id, unique within the call site
+    std::string global; // Global: name of the global
+
+    ArgSummary() : kind(Unknown), bits(0), value(0), object(0) {}
+
+    bool isConstant() const { return kind == ConstInt || kind == Null; }
+    bool isPointer() const { return kind == UnknownPtr || kind == Null || kind == LocalObject || kind == Global; }
+
+    bool operator==(const ArgSummary &O) const;
+    bool operator<(const ArgSummary &O) const;
+
+    std::string str() const;
+    static bool parse(const std::string &S, ArgSummary &A);
+  };
+
+  struct CallSiteSummary {
+    std::string caller;
+    std::string callee;
+    std::vector<ArgSummary> args;
+
+    // Constant actuals, by argument index
+    std::vector< std::pair<unsigned, ArgSummary> > constants() const;
+
+    // True if every pointer actual points into a distinct local object, and
+    // there are at least two of them.
+    bool hasDisjointPointerArgs() const;
+  };
+
+  struct FunctionSummary {
+    std::string name;
+    unsigned size;
+    unsigned numArgs;
+
+    FunctionSummary() : size(0), numArgs(0) {}
+  };
+
+  // Summary of the cross-module relevant parts of a module: the externally
+  // visible functions it defines and the calls it makes to externally
+  // visible functions.
+  struct ModuleSummary {
+    std::string module;
+    std::vector<FunctionSummary> functions;
+    std::vector<CallSiteSummary> calls;
+
+    void write(raw_ostream &O) const;
+    bool read(std::istream &in);
+  };
+
+  // A clone picked by the decision phase.
+  struct CloneDecision {
+    enum Kind {
+      ConstArgs,
+      NoAlias
+    };
+
+    Kind kind;
+    std::string callee;
+    std::string clone;
+    std::vector< std::pair<unsigned, ArgSummary> > constants;
+
+    // True if the call site can be redirected to this clone
+    bool matches(const CallSiteSummary &CS) const;
+
+    std::string str() const;
+    static bool parse(const std::string &S, CloneDecision &D);
+  };
+
+  bool summarizable(const Function *F);
+  FunctionSummary summarizeFunction(const Function *F);
+  CallSiteSummary summarizeCallSite(CallSite CS);
+  Constant* getArgConstant(const ArgSummary &A, Type *Ty);
+
+  bool readDecisions(const std::string &fileName, std::vector<CloneDecision> &decisions);
+}
+
+#endif
@@ -6,6 +6,14 @@ using namespace llvm;
 static RegisterPass<DeadStoreEliminationPass>
 X("dead-store-elimination", "Remove dead stores", false, true);
 
+static cl::opt<unsigned>
+DSETimeBudget("dse-time-budget", cl::init(0),
+              cl::desc("Seconds dead-store-elimination may take before it stops cloning (0: no limit)"));
+
+static cl::opt<unsigned>
+DSEMemoryBudget("dse-memory-budget", cl::init(0),
+                cl::desc("Megabytes dead-store-elimination may use before it stops cloning (0: no limit)"));
+
 static uint64_t getPointerSize(const Value *V, AliasAnalysis &AA) {
   uint64_t Size;
   if (getObjectSize(V, Size, AA.getDataLayout(), AA.getTargetLibraryInfo()))
@@ -15,13 +23,19 @@ static uint64_t getPointerSize(const Value *V, AliasAnalysis &AA) {
   }
 }
 
+static cl::opt<double>
+DSEColdRatio("dse-cold-ratio", cl::init(0),
+             cl::desc("Share the regions of a function that run less than this ratio of its calls between it and its clones (0: clone whole functions)"));
+
 void DeadStoreEliminationPass::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<AliasAnalysis>();
+  AU.addRequired<BlockFrequencyInfo>();
+  AU.addRequired<DominatorTree>();
   AU.addRequired<MemoryDependenceAnalysis>();
   AU.setPreservesAll();
 }
 
-DeadStoreEliminationPass::DeadStoreEliminationPass() : ModulePass(ID) {
+DeadStoreEliminationPass::DeadStoreEliminationPass() : ModulePass(ID), budget("dead-store-elimination") {
   RemovedStores   = 0;
   FunctionsCount  = 0;
   FunctionsCloned = 0;
@@ -33,6 +47,7 @@ DeadStoreEliminationPass::DeadStoreEliminationPass() : ModulePass(ID) {
 
 
 bool DeadStoreEliminationPass::runOnModule(Module &M) {
+  budget.reset(DSETimeBudget, DSEMemoryBudget);
 
   //Get some stats before doing anything
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
@@ -146,7 +161,7 @@ void DeadStoreEliminationPass::runNotUsedDeadStoreAnalysis() {
       if (deadArguments.count(inst)) continue;
 
       CallSite CS(inst);
-      if (!CS.isCallee(UI)) continue;
+      if (!CS.isCallee(UI) || isColdCall(CS)) continue;
 
       CallSite::arg_iterator actualArgIter = CS.arg_begin();
       Function::arg_iterator formalArgIter = F->arg_begin();
@@ -270,6 +285,8 @@ bool DeadStoreEliminationPass::isRefAfterCallSite(Value* v, CallSite &CS) {
       AliasAnalysis::ModRefResult mrf = AA->getModRefInfo(inst, loc);
       DEBUG(errs() << mrf << "\n");
       if (mrf == AliasAnalysis::Ref || mrf == AliasAnalysis::ModRef) {
+        CallSite laterCS(inst);
+        if (laterCS && !modRef.mayRead(inst, v)) continue;
         return true;
       }
     }
@@ -283,7 +300,7 @@ bool DeadStoreEliminationPass::isRefAfterCallSite(Value* v, CallSite &CS) {
 void DeadStoreEliminationPass::runOverwrittenDeadStoreAnalysis(Module &M) {
   DEBUG(errs() << "Running overwritten dead store analysis...\n");
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-    if (!F->isDeclaration()) {
+    if (!F->isDeclaration() && !isColdFunction(F)) {
       runOverwrittenDeadStoreAnalysisOnFn(*F);
     }
   }
@@ -311,6 +328,7 @@ void DeadStoreEliminationPass::runOverwrittenDeadStoreAnalysisOnFn(Function &F)
            if (!fnThatStoreOnArgs.count(calledFn)) continue;
 
            CallSite CS(depInst);
+           if (isColdCall(CS)) continue;
 
            CallSite::arg_iterator actualArgIter = CS.arg_begin();
            Function::arg_iterator formalArgIter = calledFn->arg_begin();
@@ -470,10 +488,22 @@ bool DeadStoreEliminationPass::cloneFunctions() {
       std::set<Value*> deadArgs = deadArguments[caller];
 
       if (!clonedFns.count(deadArgs)) {
+        // Keep the clones made so far, but do not make new ones
+        if (budget.exceeded()) {
+          budget.degrade("stopped creating dead store clones");
+          continue;
+        }
+
+        if (DSEColdRatio > 0) {
+          partial.outlineColdRegions(*F, getAnalysis<BlockFrequencyInfo>(*F),
+                                     getAnalysis<DominatorTree>(*F), DSEColdRatio);
+        }
+
         // Clone function if a proper clone doesnt already exist
         std::stringstream suffix;
         suffix << ".deadstores" << i;
         Function* NF = cloneFunctionWithoutDeadStore(F, caller, suffix.str());
+        if (DSEColdRatio > 0) partial.recordClone(NF, F);
         replaceCallingInst(caller, NF);
         clonedFns[deadArgs] = NF;
         ClonesCount++;
@@ -567,6 +597,7 @@ void DeadStoreEliminationPass::replaceCallingInst(Instruction* caller,
     InvokeInst *invokeInst = dyn_cast<InvokeInst>(caller);
     invokeInst->setCalledFunction(fn);
   }
+  modRef.invalidate(caller->getParent()->getParent());
 }
 
 
@@ -583,4 +614,6 @@ void DeadStoreEliminationPass::printSet(raw_ostream &O,
 
 void DeadStoreEliminationPass::print(raw_ostream &O, const Module *M) const {
   O << "Number of dead stores removed: " << RemovedStores << "\n";
+  budget.print(O);
+  partial.print(O);
 }
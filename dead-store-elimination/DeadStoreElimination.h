@@ -7,11 +7,16 @@
 #include "llvm/Analysis/AliasSetTracker.h"
 #include "llvm/Analysis/MemoryBuiltins.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Analysis/MemoryDependenceAnalysis.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "../utils/ColdFunctions.h"
+#include "../utils/CompileBudget.h"
+#include "../utils/ModRefSummary.h"
+#include "../utils/PartialCloning.h"
 
 namespace llvm {
   STATISTIC(RemovedStores,   "Number of removed stores");
@@ -48,6 +53,12 @@ namespace llvm {
     AliasAnalysis *AA;
     MemoryDependenceAnalysis *MDA;
 
+    CompileBudget budget;
+    PartialCloning partial;
+
+    // What the functions we see read, which alias analysis does not know
+    ModRefSummary modRef;
+
    public:
     static char ID;
 
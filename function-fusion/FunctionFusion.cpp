@@ -2,7 +2,15 @@
 
 using namespace llvm;
 
-FunctionFusion::FunctionFusion() : ModulePass(ID) {
+static cl::opt<unsigned>
+FusionTimeBudget("function-fusion-time-budget", cl::init(0),
+                 cl::desc("Seconds function-fusion may take before it stops fusing (0: no limit)"));
+
+static cl::opt<unsigned>
+FusionMemoryBudget("function-fusion-memory-budget", cl::init(0),
+                   cl::desc("Megabytes function-fusion may use before it stops fusing (0: no limit)"));
+
+FunctionFusion::FunctionFusion() : ModulePass(ID), budget("function-fusion") {
   FunctionsCount    = 0;
   CallsCount        = 0;
   FunctionsCloned   = 0;
@@ -15,19 +23,26 @@ bool FunctionFusion::isExternalFunctionCall(CallInst* CS) {
   return false;
 }
 
-bool FunctionFusion::areNeighborInsts(Instruction* first, Instruction* second) {
-   BasicBlock* BB = first->getParent();
-   for (BasicBlock::iterator I = BB->begin(); I != BB->end();) {
-     Instruction *inst = I;
-     if (inst == first) {
-      Instruction *nextInst = ++I;
-      if (nextInst == second) return true;
-      else return false;
-     } else {
-       ++I;
-     }
-   }
-   return false;
+// The fused call replaces the use, so the definition moves down to it.
+// Nothing in between may touch memory the definition writes, or write
+// memory the definition reads.
+bool FunctionFusion::canSinkTo(Instruction* definition, Instruction* use) {
+  BasicBlock* BB = definition->getParent();
+  if (use->getParent() != BB) return false;
+
+  FunctionModRef definitionEffect;
+  modRef.getEffect(definition, definitionEffect);
+
+  BasicBlock::iterator I = definition;
+  for (++I; I != BB->end(); ++I) {
+    Instruction *inst = I;
+    if (inst == use) return true;
+
+    FunctionModRef effect;
+    modRef.getEffect(inst, effect);
+    if (ModRefSummary::mayConflict(definitionEffect, effect)) return false;
+  }
+  return false;
 }
 
 bool FunctionFusion::hasPointerParam(Function* F) {
@@ -54,10 +69,11 @@ void FunctionFusion::visitCallSite(CallSite CS) {
       CallInst *iCI = dyn_cast<CallInst>(iCS.getInstruction());
       if(isExternalFunctionCall(CI) || isExternalFunctionCall(iCI)
           || toBeModified.count(CI) || toBeModified.count(iCI)
+          || isColdCall(CS) || isColdCall(iCS)
           //|| hasPointerParam(CS.getCalledFunction())
           || CS.getCalledFunction()->isVarArg()
           || iCS.getCalledFunction()->isVarArg()
-          || !areNeighborInsts(CI, iCI)
+          || !canSinkTo(CI, iCI)
           //|| CS.getCalledFunction()->getReturnType()->isPointerTy()
           //|| hasPointerParam(iCS.getCalledFunction())
           //|| iCS.getCalledFunction()->getReturnType()->isPointerTy()
@@ -98,6 +114,7 @@ void FunctionFusion::selectToClone(CallSite& use, CallSite& definition) {
 
 
 bool FunctionFusion::runOnModule(Module &M) {
+  budget.reset(FusionTimeBudget, FusionMemoryBudget);
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (!F->isDeclaration()) {
       FunctionsCount++;
@@ -107,6 +124,7 @@ bool FunctionFusion::runOnModule(Module &M) {
 
   bool modifiedModule = false;
   bool modified       = false;
+  unsigned rounds     = 0;
   do {
     toBeModified.clear();
     functions2fuse.clear();
@@ -115,6 +133,15 @@ bool FunctionFusion::runOnModule(Module &M) {
     modifiedModule = modifiedModule | modified;
 
     DEBUG(errs() << "one round! " << modified << "\n");
+
+    // Every round is complete, so stopping between rounds is safe
+    ++rounds;
+    if (modified && budget.exceeded()) {
+      std::stringstream what;
+      what << "stopped fusing after " << rounds << " rounds";
+      budget.degrade(what.str());
+      break;
+    }
   } while (modified);
 
   return modifiedModule;
@@ -280,6 +307,7 @@ void FunctionFusion::ReplaceCallInstsWithFusion(Function* fn, CallInst* use, Cal
 
   // Replace uses of 'use' values
   use->replaceAllUsesWith(newCI);
+  modRef.invalidate(use->getParent()->getParent());
 
   // Remove previous callInsts
   use->eraseFromParent();
@@ -290,6 +318,7 @@ void FunctionFusion::ReplaceCallInstsWithFusion(Function* fn, CallInst* use, Cal
 void FunctionFusion::print(raw_ostream& O, const Module* M) const {
   O << "# functions; # cloned functions; # calls; # replaced calls\n";
   O << FunctionsCount << ";" << FunctionsCloned << ";" << CallsCount << ";" << CallsReplaced << "\n";
+  budget.print(O);
 }
 
 // Register the pass to the LLVM framework
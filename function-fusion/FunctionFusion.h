@@ -15,11 +15,15 @@
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Regex.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "../utils/ColdFunctions.h"
+#include "../utils/CompileBudget.h"
+#include "../utils/ModRefSummary.h"
 
 #undef DEBUG_TYPE
 #define DEBUG_TYPE "function-fusion"
@@ -35,9 +39,12 @@ namespace llvm {
     std::map < std::pair < std::pair < Function*, Function* >, unsigned >, int > functions2fuseHistogram;
     std::map < std::pair < std::pair < Function*, Function* >, unsigned >, Function*> clonedFunctions;
 
+    CompileBudget budget;
+    ModRefSummary modRef;
+
     bool isExternalFunctionCall(CallInst* CS);
     bool hasPointerParam(Function* F);
-    bool areNeighborInsts(Instruction* first, Instruction* second);
+    bool canSinkTo(Instruction* definition, Instruction* use);
     void selectToClone(CallSite& use, CallSite& definition);
     bool cloneFunctions();
     Function* fuseFunctions(Function* use, Function* definition, unsigned argPosition);
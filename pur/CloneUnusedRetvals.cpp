@@ -19,6 +19,8 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/CallSite.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "../utils/ColdFunctions.h"
+#include "../utils/CompileBudget.h"
 
 #include <map>
 #include <vector>
@@ -31,6 +33,14 @@ STATISTIC(NrCallInst,          "Number of calls");
 STATISTIC(NrPotentialCallInst, "Number of promissor calls");
 STATISTIC(NrSubstCallInst,     "Number of replaced calls");
 
+static cl::opt<unsigned>
+NoRetTimeBudget("clone-unused-retvals-time-budget", cl::init(0),
+                cl::desc("Seconds clone-unused-retvals may take before it stops cloning (0: no limit)"));
+
+static cl::opt<unsigned>
+NoRetMemoryBudget("clone-unused-retvals-memory-budget", cl::init(0),
+                  cl::desc("Megabytes clone-unused-retvals may use before it stops cloning (0: no limit)"));
+
 namespace {
 
   struct CloneUnusedRetvals :
@@ -45,8 +55,9 @@ namespace {
 
     CallRefsMap unusedRetvals;
     Fn2CloneMap clonedFunctions;
+    CompileBudget budget;
 
-    CloneUnusedRetvals() : ModulePass(ID) {
+    CloneUnusedRetvals() : ModulePass(ID), budget("clone-unused-retvals") {
       NrFns = 0;
       NrCloneFns = 0;
       NrCallInst = 0;
@@ -108,6 +119,10 @@ namespace {
       if (calledFunction->isDeclaration())
         return;
 
+      // Nor is it worth cloning for calls that never run.
+      if (isColdCall(CS))
+        return;
+
       // And we're interested in unused retvals...
       if (!isUnusedRetval(CS))
         return;
@@ -137,6 +152,13 @@ namespace {
           Fn2CloneMap::iterator i = clonedFunctions.find(Fn);
           if (i == clonedFunctions.end()) {
 
+            // Keep the clones made so far, but do not make new ones. Calls
+            // to functions without a clone are left untouched.
+            if (budget.exceeded()) {
+              budget.degrade("stopped creating noret clones");
+              break;
+            }
+
             NrCloneFns++;
             NrPotentialCallInst += Fn->getNumUses();
 
@@ -306,6 +328,7 @@ namespace {
 
     // Prune all unused retvals available in the module
     virtual bool runOnModule(Module &M) {
+      budget.reset(NoRetTimeBudget, NoRetMemoryBudget);
       getStats(M);
       visit(M); // Collect unused retvals
       cloneFunctions();
@@ -315,6 +338,10 @@ namespace {
 
     // As we're cloning functions, the CFG won't be preserved.
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {}
+
+    virtual void print(raw_ostream &O, const Module *M) const {
+      budget.print(O);
+    }
   };
 
 } // end empty namespace.
@@ -0,0 +1,88 @@
+/*
+ * Value profiling runtime
+ *
+ * Programs instrumented by the value-profiler pass call __cbo_profile_value
+ * at the entry of the profiled functions, once per selected argument. Each
+ * (function, argument) pair has its own site, a global the pass creates, in
+ * which the first CBO_VALUES_PER_SITE distinct values are counted. Later
+ * values only count towards the total, which is enough to tell a value that
+ * is passed nearly every time.
+ *
+ * At exit, every site that ran is appended to the file named by the
+ * CBO_VALUE_PROFILE environment variable, or cbo-values.prof, one line per
+ * site:
+ *
+ *   function argument total value:count value:count ...
+ *
+ * Internal functions are written as module:function, as files of the same
+ * program may each have one of that name.
+ *
+ * Lines of several runs are summed by the reader, so the file must be
+ * removed to start a new profile. Counters are not atomic: profiles of
+ * multithreaded programs are approximate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Must match the site type the value-profiler pass creates */
+#define CBO_VALUES_PER_SITE 8
+
+struct CBOValueSite {
+  const char *function;
+  uint32_t argument;
+  uint32_t registered;
+  struct CBOValueSite *next;
+  uint64_t total;
+  int64_t values[CBO_VALUES_PER_SITE];
+  uint64_t counts[CBO_VALUES_PER_SITE];
+};
+
+static struct CBOValueSite *sites = 0;
+
+static void writeValueProfile(void) {
+  const char *name = getenv("CBO_VALUE_PROFILE");
+  FILE *out = fopen(name ? name : "cbo-values.prof", "a");
+  struct CBOValueSite *site;
+  unsigned i;
+
+  if (!out) {
+    perror("cbo: cannot write value profile");
+    return;
+  }
+
+  for (site = sites; site; site = site->next) {
+    fprintf(out, "%s %u %llu", site->function, site->argument, (unsigned long long)site->total);
+    for (i = 0; i < CBO_VALUES_PER_SITE && site->counts[i]; ++i) {
+      fprintf(out, " %lld:%llu", (long long)site->values[i], (unsigned long long)site->counts[i]);
+    }
+    fprintf(out, "\n");
+  }
+
+  fclose(out);
+}
+
+void __cbo_profile_value(struct CBOValueSite *site, int64_t value) {
+  unsigned i;
+
+  if (!site->registered) {
+    if (!sites) atexit(writeValueProfile);
+    site->registered = 1;
+    site->next = sites;
+    sites = site;
+  }
+
+  site->total++;
+  for (i = 0; i < CBO_VALUES_PER_SITE; ++i) {
+    if (!site->counts[i]) {
+      site->values[i] = value;
+      site->counts[i] = 1;
+      return;
+    }
+    if (site->values[i] == value) {
+      site->counts[i]++;
+      return;
+    }
+  }
+}
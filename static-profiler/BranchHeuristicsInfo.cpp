@@ -21,6 +21,9 @@
 //   (7) Store Heuristic       (55%)
 //   (8) Loop Header Heuristic (75%)
 //   (9) Guard Heuristic       (62%)
+// Hints given with __builtin_expect are matched as one more heuristic, whose
+// probability is the one LowerExpectIntrinsic uses for branch weights:
+//  (10) Expect Heuristic      (94%)
 //
 // References:
 // Ball, T. and Larus, J. R. 1993. Branch prediction for free. In Proceedings of
@@ -37,6 +40,7 @@
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/Dominators.h"
@@ -59,6 +63,7 @@ const struct BranchProbabilities
   { STORE_HEURISTIC,       0.55f, 0.45f, "Store Heuristic"       },
   { LOOP_HEADER_HEURISTIC, 0.75f, 0.25f, "Loop Header Heuristic" },
   { GUARD_HEURISTIC,       0.62f, 0.38f, "Guard Heuristic"       },
+  { EXPECT_HEURISTIC,      0.94f, 0.06f, "Expect Heuristic"      },
 };
 
 BranchHeuristicsInfo::BranchHeuristicsInfo(BranchPredictionInfo *BPI) {
@@ -100,6 +105,8 @@ Prediction BranchHeuristicsInfo::MatchHeuristic(BranchHeuristics bh,
       return MatchLoopHeaderHeuristic(root);
     case GUARD_HEURISTIC:
       return MatchGuardHeuristic(root);
+    case EXPECT_HEURISTIC:
+      return MatchExpectHeuristic(root);
   }
 }
 
@@ -546,3 +553,62 @@ Prediction BranchHeuristicsInfo::MatchGuardHeuristic(BasicBlock *root) const {
   return (matched ? pred : empty);
 }
 
+
+/// MatchExpectHeuristic - Predict that a comparison of the result of an
+/// llvm.expect intrinsic (__builtin_expect) against a constant will have
+/// the outcome the expected value gives it.
+/// @returns a Prediction that is a pair in which the first element is the
+/// successor taken, and the second the successor not taken.
+Prediction BranchHeuristicsInfo::MatchExpectHeuristic(BasicBlock *root) const {
+  // Last instruction of basic block.
+  TerminatorInst *TI = root->getTerminator();
+
+  // Basic block successors. True and False branches.
+  BasicBlock *trueSuccessor = TI->getSuccessor(0);
+  BasicBlock *falseSuccessor = TI->getSuccessor(1);
+
+  // Is the last instruction a Branch Instruction?
+  BranchInst *BI = dyn_cast<BranchInst>(TI);
+  if (!BI || !BI->isConditional())
+    return empty;
+
+  // Conditional instruction.
+  Value *cond = BI->getCondition();
+
+  // Front ends test the expected value against zero, as in
+  // "icmp ne (llvm.expect(x, 1)), 0". A boolean may also be branched on
+  // directly.
+  Value *value = cond;
+  ConstantInt *against = NULL;
+  bool equal = false;
+  if (ICmpInst *II = dyn_cast<ICmpInst>(cond)) {
+    if (!II->isEquality())
+      return empty;
+
+    value = II->getOperand(0);
+    against = dyn_cast<ConstantInt>(II->getOperand(1));
+    equal = II->getPredicate() == ICmpInst::ICMP_EQ;
+  }
+
+  IntrinsicInst *expect = dyn_cast<IntrinsicInst>(value);
+  if (!expect || expect->getIntrinsicID() != Intrinsic::expect)
+    return empty;
+
+  ConstantInt *expected = dyn_cast<ConstantInt>(expect->getArgOperand(1));
+  if (!expected)
+    return empty;
+
+  // Outcome of the condition when the expected value shows up.
+  bool outcome;
+  if (value == cond)
+    outcome = !expected->isZero();
+  else if (against)
+    outcome = (expected->getValue() == against->getValue()) == equal;
+  else
+    return empty;
+
+  if (outcome)
+    return std::make_pair(trueSuccessor, falseSuccessor);
+
+  return std::make_pair(falseSuccessor, trueSuccessor);
+}
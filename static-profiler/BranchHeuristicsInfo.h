@@ -38,12 +38,15 @@ namespace llvm {
     RETURN_HEURISTIC,
     STORE_HEURISTIC,
     LOOP_HEADER_HEURISTIC,
-    GUARD_HEURISTIC
+    GUARD_HEURISTIC,
+    EXPECT_HEURISTIC
   };
 
   // Hold the information regarding the heuristic, the probability of taken and
   // not taken the branches and the heuristic name, for debugging purposes.
-  // The probabilities were taken from Table 1 in Wu's (1994) paper.
+  // The probabilities were taken from Table 1 in Wu's (1994) paper, except for
+  // the expect heuristic, which weighs __builtin_expect as LowerExpectIntrinsic
+  // does (64 to 4).
   // Note that the enumeration order is respected, to allow a direct access to
   // the probabilities.
   struct BranchProbabilities {
@@ -75,8 +78,8 @@ namespace llvm {
     // Prediction empty contains null values and indicates an error.
     Prediction empty;
 
-    // There are 9 branch prediction heuristics.
-    static const unsigned numBranchHeuristics = 9;
+    // There are 10 branch prediction heuristics.
+    static const unsigned numBranchHeuristics = 10;
 
     static const struct BranchProbabilities probList[numBranchHeuristics];
 
@@ -141,6 +144,13 @@ namespace llvm {
     /// @returns a Prediction that is a pair in which the first element is the
     /// successor taken, and the second the successor not taken.
     Prediction MatchGuardHeuristic(BasicBlock *root) const;
+
+    /// MatchExpectHeuristic - Predict that a comparison of the result of an
+    /// llvm.expect intrinsic (__builtin_expect) against a constant will have
+    /// the outcome the expected value gives it.
+    /// @returns a Prediction that is a pair in which the first element is the
+    /// successor taken, and the second the successor not taken.
+    Prediction MatchExpectHeuristic(BasicBlock *root) const;
   public:
     // Define an edge as an pair of basic blocks.
     typedef std::pair<const BasicBlock *, const BasicBlock *> Edge;
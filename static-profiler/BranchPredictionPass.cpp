@@ -13,6 +13,11 @@
 // takes into consideration the heuristics proposed by Ball (1993) to make the
 // predictions.
 //
+// Branches that already carry branch_weights metadata, from an earlier profile
+// or from lowering __builtin_expect, keep the probabilities those weights give
+// them. Branches on a __builtin_expect that was not lowered yet take the hint
+// as one more heuristic, the most confident of all.
+//
 // References:
 // Ball, T. and Larus, J. R. 1993. Branch prediction for free. In Proceedings of
 // the ACM SIGPLAN 1993 Conference on Programming Language Design and
@@ -36,6 +41,8 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/Analysis/Passes.h"
 #include "llvm/Analysis/Dominators.h"
 #include "llvm/Analysis/PostDominators.h"
@@ -209,6 +216,9 @@ void BranchPredictionPass::CalculateBranchProbabilities(BasicBlock *BB) {
                      << ": " << format("%.3f", EdgeProbabilities[edge])
                      << "\n");
       }
+    } else if (CalculateWeightedProbabilities(BB)) {
+      // The branch weights said exactly how likely each successor is, so
+      // there is nothing left for the heuristics to guess.
     } else if (backedges > 0 && backedges < successors) {
       // Has some back edges, but not all.
       for (unsigned s = 0; s < successors; ++s) {
@@ -290,6 +300,59 @@ void BranchPredictionPass::CalculateBranchProbabilities(BasicBlock *BB) {
   }
 }
 
+/// CalculateWeightedProbabilities - Take the probabilities of the successors
+/// of a basic block from the branch_weights metadata of its terminator.
+/// @returns false if the terminator has no usable branch weights.
+bool BranchPredictionPass::CalculateWeightedProbabilities(BasicBlock *BB) {
+  // Obtain the last instruction.
+  TerminatorInst *TI = BB->getTerminator();
+  unsigned successors = TI->getNumSuccessors();
+
+  // Branch weights have one operand per successor, after their name.
+  MDNode *weights = TI->getMetadata(LLVMContext::MD_prof);
+  if (!weights || weights->getNumOperands() != successors + 1)
+    return false;
+
+  MDString *name = dyn_cast<MDString>(weights->getOperand(0));
+  if (!name || name->getString() != "branch_weights")
+    return false;
+
+  // Each weight may take 32 bits, so their sum needs more.
+  uint64_t total = 0;
+  for (unsigned s = 0; s < successors; ++s) {
+    ConstantInt *weight = dyn_cast<ConstantInt>(weights->getOperand(s + 1));
+    if (!weight)
+      return false;
+
+    total += weight->getZExtValue();
+  }
+
+  // Weights that are all zero say nothing about the successors.
+  if (total == 0)
+    return false;
+
+  // Several switch cases may lead to the same successor, and their weights
+  // add up on the same edge.
+  for (unsigned s = 0; s < successors; ++s)
+    EdgeProbabilities[std::make_pair(BB, TI->getSuccessor(s))] = 0.0f;
+
+  for (unsigned s = 0; s < successors; ++s) {
+    ConstantInt *weight = cast<ConstantInt>(weights->getOperand(s + 1));
+    Edge edge = std::make_pair(BB, TI->getSuccessor(s));
+    EdgeProbabilities[edge] += (double) weight->getZExtValue() / total;
+  }
+
+  for (unsigned s = 0; s < successors; ++s) {
+    BasicBlock *succ = TI->getSuccessor(s);
+    Edge edge = std::make_pair(BB, succ);
+    DEBUG(errs() << "    " << BB->getName() << "->" << succ->getName()
+                 << ": " << format("%.3f", EdgeProbabilities[edge])
+                 << " (branch weights)\n");
+  }
+
+  return true;
+}
+
 /// addEdgeProbability - If a heuristic matches, calculates the edge probability
 /// combining previous predictions acquired.
 void BranchPredictionPass::addEdgeProbability(BranchHeuristics heuristic,
@@ -60,6 +60,12 @@ namespace llvm {
     /// basic block.
     void CalculateBranchProbabilities(BasicBlock *BB);
 
+    /// CalculateWeightedProbabilities - Take the probabilities of the
+    /// successors of a basic block from the branch_weights metadata of its
+    /// terminator, which override the heuristics.
+    /// @returns false if the terminator has no usable branch weights.
+    bool CalculateWeightedProbabilities(BasicBlock *BB);
+
     /// addEdgeProbability - If a heuristic matches, calculates the edge
     /// probability combining previous predictions acquired.
     void addEdgeProbability(BranchHeuristics heuristic, const BasicBlock *root,
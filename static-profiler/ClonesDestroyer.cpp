@@ -81,7 +81,7 @@ void ClonesDestroyer::print(raw_ostream& O, const Module* M) const {
 void ClonesDestroyer::collectFunctions(Function &F) {
   std::string fnName = F.getName();
 
-  Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.noret))+");
+  Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.noret)|(\\.nofree[0-9]+)|(\\.nonnull[0-9]+)|(\\.scalar[0-9]+)|(\\.nounwind[0-9]+))+");
   bool isCloned = ending.match(fnName);
 
   std::string originalName = fnName;
@@ -89,6 +89,10 @@ void ClonesDestroyer::collectFunctions(Function &F) {
     Regex noaliasend("\\.noalias");
     Regex constargsend("\\.constargs[0-9]+");
     Regex noretend("\\.noret");
+    Regex nofreeend("\\.nofree[0-9]+");
+    Regex nonnullend("\\.nonnull[0-9]+");
+    Regex scalarend("\\.scalar[0-9]+");
+    Regex nounwindend("\\.nounwind[0-9]+");
 
     if (noaliasend.match(fnName)) {
       originalName = noaliasend.sub("", originalName);
@@ -99,6 +103,18 @@ void ClonesDestroyer::collectFunctions(Function &F) {
     if (noretend.match(fnName)) {
       originalName = noretend.sub("", originalName);
     }
+    if (nofreeend.match(fnName)) {
+      originalName = nofreeend.sub("", originalName);
+    }
+    if (nonnullend.match(fnName)) {
+      originalName = nonnullend.sub("", originalName);
+    }
+    if (scalarend.match(fnName)) {
+      originalName = scalarend.sub("", originalName);
+    }
+    if (nounwindend.match(fnName)) {
+      originalName = nounwindend.sub("", originalName);
+    }
   }
   functions[originalName].push_back(&F);
 }
@@ -115,7 +131,7 @@ bool ClonesDestroyer::removeWorthlessClones() {
     for (int i = 0; i < numFunctions; ++i) {
       Function* F = it->second[i];
       std::string fnName = F->getName();
-      Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.noret))+");
+      Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.noret)|(\\.nofree[0-9]+)|(\\.nonnull[0-9]+)|(\\.scalar[0-9]+)|(\\.nounwind[0-9]+))+");
       bool isCloned = ending.match(fnName);
       if (isCloned) {
         clonedFns.push_back(F);
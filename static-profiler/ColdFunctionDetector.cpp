@@ -0,0 +1,176 @@
+#include "ColdFunctionDetector.h"
+#include "BlockEdgeFrequencyPass.h"
+
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Format.h"
+#include "llvm/ADT/Statistic.h"
+#include "../utils/ColdFunctions.h"
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "cold-functions"
+
+using namespace llvm;
+
+STATISTIC(ColdFunctions, "Number of functions marked cold");
+STATISTIC(AlreadyCold,   "Number of functions already cold made minsize");
+
+static cl::opt<double>
+ColdThreshold("cold-function-threshold", cl::init(0.01),
+              cl::desc("Calls per run of the program below which a function is cold"));
+
+static cl::opt<bool>
+ColdWholeProgram("cold-functions-whole-program", cl::init(false),
+                 cl::desc("Assume a module that defines main is the whole program, so only main is called from outside"));
+
+// Recursion makes the number of calls a fixed point, only approximated
+static const unsigned MaxRounds = 32;
+
+// Past this many calls, a function is as hot as it gets
+static const double MaxInvocations = 1e9;
+
+char ColdFunctionDetector::ID = 0;
+
+static RegisterPass<ColdFunctionDetector> X("cold-functions",
+                "Mark the functions that effectively never run cold and minsize", false, false);
+
+ColdFunctionDetector::ColdFunctionDetector() : ModulePass(ID) {
+  ColdFunctions = 0;
+  AlreadyCold   = 0;
+}
+
+void ColdFunctionDetector::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<BlockEdgeFrequencyPass>();
+  AU.setPreservesCFG();
+}
+
+bool ColdFunctionDetector::runOnModule(Module &M) {
+  callFrequencies.clear();
+  invocations.clear();
+  coldNames.clear();
+
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!F->isDeclaration()) findCallFrequencies(F);
+  }
+  propagateInvocations(M);
+
+  bool modified = false;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration() || invocations[F] >= ColdThreshold) continue;
+
+    DEBUG(errs() << "Cold: " << F->getName() << " ("
+                 << format("%.3f", invocations[F]) << " calls)\n");
+
+    if (isColdFunction(F)) AlreadyCold++;
+    else ColdFunctions++;
+
+    F->addFnAttr(Attribute::Cold);
+    F->addFnAttr(Attribute::MinSize);
+    F->addFnAttr(Attribute::OptimizeForSize);
+    coldNames.push_back(F->getName());
+    modified = true;
+  }
+
+  return modified;
+}
+
+// Calls F makes to the functions of the module, weighted by the frequency of
+// their blocks, which is per call of F
+void ColdFunctionDetector::findCallFrequencies(Function *F) {
+  BlockEdgeFrequencyPass &BEFP = getAnalysis<BlockEdgeFrequencyPass>(*F);
+  CallFrequencies &calls = callFrequencies[F];
+
+  for (Function::iterator it = F->begin(); it != F->end(); ++it) {
+    BasicBlock* BB = it;
+
+    // The calls on the way out of the program run at most once
+    if (endsProgram(BB)) continue;
+
+    double BB_freq = BEFP.getBlockFrequency(BB);
+    for (BasicBlock::iterator I = BB->begin(); I != BB->end(); ++I) {
+      CallSite CS(I);
+      if (!CS) continue;
+
+      Function *G = CS.getCalledFunction();
+      if (G && !G->isDeclaration()) calls[G] += BB_freq;
+    }
+  }
+}
+
+// Calls per run of the program, from the calls of the roots and the call
+// frequencies of every caller
+void ColdFunctionDetector::propagateInvocations(Module &M) {
+  // Defining main does not make the module the whole program: other files
+  // may call its external functions, however often
+  Function *main = M.getFunction("main");
+  bool wholeProgram = ColdWholeProgram && main && !main->isDeclaration();
+
+  std::map<Function*, double> roots;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    roots[F] = isRoot(F, wholeProgram) ? 1.0 : 0.0;
+  }
+  invocations = roots;
+
+  for (unsigned round = 0; round < MaxRounds; ++round) {
+    std::map<Function*, double> next = roots;
+    for (std::map<Function*, CallFrequencies>::iterator it = callFrequencies.begin();
+         it != callFrequencies.end(); ++it) {
+      double callerInvocations = invocations[it->first];
+      for (CallFrequencies::iterator C = it->second.begin(); C != it->second.end(); ++C) {
+        next[C->first] += callerInvocations * C->second;
+      }
+    }
+
+    bool changed = false;
+    for (std::map<Function*, double>::iterator it = next.begin(); it != next.end(); ++it) {
+      if (it->second > MaxInvocations) it->second = MaxInvocations;
+      double old = invocations[it->first];
+      changed = changed || it->second - old > 1e-6 * (old + 1.0);
+    }
+
+    invocations.swap(next);
+    if (!changed) break;
+  }
+}
+
+// Whether F may be called from where no call frequency tells how often: from
+// outside the program, or through a pointer
+bool ColdFunctionDetector::isRoot(Function *F, bool wholeProgram) const {
+  if (F->getName() == "main") return true;
+  if (!wholeProgram && !F->hasLocalLinkage()) return true;
+
+  for (Value::use_iterator UI = F->use_begin(), E = F->use_end(); UI != E; ++UI) {
+    CallSite CS(*UI);
+    if (!CS || !CS.isCallee(UI)) return true;
+  }
+  return false;
+}
+
+// Whether BB leaves the program by calling a library function that does not
+// return, such as exit or abort. Calls to the functions of the program that
+// do not return, such as a server loop, do not count.
+bool ColdFunctionDetector::endsProgram(BasicBlock *BB) const {
+  Instruction *T = BB->getTerminator();
+  if (!isa<UnreachableInst>(T) || T == &BB->front()) return false;
+
+  BasicBlock::iterator I = T;
+  --I;
+  CallSite CS(I);
+  if (!CS) return false;
+
+  Function *F = CS.getCalledFunction();
+  return F && F->isDeclaration();
+}
+
+void ColdFunctionDetector::print(raw_ostream &O, const Module *M) const {
+  O << "Number of functions marked cold: " << ColdFunctions << '\n';
+  O << "Number of functions already cold made minsize: " << AlreadyCold << '\n';
+  for (std::vector<std::string>::const_iterator it = coldNames.begin(); it != coldNames.end(); ++it) {
+    O << "  " << *it << '\n';
+  }
+}
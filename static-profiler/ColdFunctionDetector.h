@@ -0,0 +1,45 @@
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/Support/raw_ostream.h"
+
+
+namespace llvm {
+
+  // Estimates how many times each function is called in a run of the
+  // program, from the block frequencies of its callers, and marks the
+  // functions that effectively never run cold and minsize: error handlers,
+  // usage printers and whatever only they call. The cloning passes leave
+  // cold functions alone, see utils/ColdFunctions.h.
+  class ColdFunctionDetector : public ModulePass {
+
+   private:
+    // Calls each function makes to each function, per call of the caller
+    typedef std::map<Function*, double> CallFrequencies;
+    std::map<Function*, CallFrequencies> callFrequencies;
+
+    // Calls of each function per run of the program
+    std::map<Function*, double> invocations;
+
+    std::vector<std::string> coldNames;
+
+    void findCallFrequencies(Function *F);
+    void propagateInvocations(Module &M);
+    bool isRoot(Function *F, bool wholeProgram) const;
+    bool endsProgram(BasicBlock *BB) const;
+
+   public:
+    static char ID;
+
+    ColdFunctionDetector();
+    ~ColdFunctionDetector() { }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const;
+    virtual bool runOnModule(Module &M);
+    void print(raw_ostream &O, const Module *M) const;
+  };
+}
@@ -0,0 +1,273 @@
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/CallingConv.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/ADT/Statistic.h"
+
+#undef DEBUG_TYPE
+#define DEBUG_TYPE "clone-abi"
+
+using namespace llvm;
+
+STATISTIC(ClonesInternalized, "Number of clones made internal");
+STATISTIC(FastccClones,       "Number of clones switched to fastcc");
+STATISTIC(DeadArgsRemoved,    "Number of unused clone arguments removed");
+STATISTIC(ArgsPromoted,       "Number of clone arguments passed by value");
+
+static cl::opt<bool>
+KeepODRClones("clone-abi-keep-odr", cl::init(false),
+              cl::desc("Leave the linkonce_odr clones, which other modules may share, untouched"));
+
+// Clones are only called from the calls the cloning passes redirected to
+// them, so once no one else can see them their calling convention and
+// arguments can be chosen for those calls alone.
+class CloneABI : public ModulePass {
+
+  // What becomes of each argument of a clone
+  enum ArgKind { DeadArg, KeptArg, PromotedArg };
+
+  public:
+
+  static char ID;
+
+  CloneABI() : ModulePass(ID) {
+    ClonesInternalized = 0;
+    FastccClones       = 0;
+    DeadArgsRemoved    = 0;
+    ArgsPromoted       = 0;
+  }
+
+  // +++++ METHODS +++++ //
+
+  bool runOnModule(Module &M);
+  virtual void print(raw_ostream& O, const Module* M) const;
+  bool hasOnlyDirectCalls(Function *F);
+  bool isPromotable(Argument *A);
+  void rewriteArguments(Function *F, const std::vector<ArgKind> &kinds);
+  AttributeSet remapAttributes(const AttributeSet &PAL, LLVMContext &Ctx, const std::vector<ArgKind> &kinds);
+};
+
+// ============================= //
+
+bool CloneABI::runOnModule(Module &M) {
+  Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret)|(\\.nofree[0-9]+)|(\\.nonnull[0-9]+)|(\\.scalar[0-9]+)|(\\.nounwind[0-9]+))+");
+
+  std::vector<Function*> clones;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration() || F->isVarArg() || !ending.match(F->getName())) continue;
+
+    // Clones clone-apply exports keep the external linkage of their original,
+    // and other modules call them through declarations of their own
+    if (!F->hasLocalLinkage() && F->getLinkage() != GlobalValue::LinkOnceODRLinkage) continue;
+    if (KeepODRClones && !F->hasLocalLinkage()) continue;
+
+    // A clone without uses may still be called from elsewhere
+    if (!F->use_empty() && hasOnlyDirectCalls(F)) clones.push_back(F);
+  }
+
+  for (std::vector<Function*>::iterator it = clones.begin(); it != clones.end(); ++it) {
+    Function *F = *it;
+
+    // Another module may have the same linkonce_odr clone, with the old
+    // ABI, and the linker could pick either
+    if (!F->hasLocalLinkage()) {
+      F->setLinkage(GlobalValue::InternalLinkage);
+      F->setVisibility(GlobalValue::DefaultVisibility);
+      ClonesInternalized++;
+    }
+
+    if (F->getCallingConv() == CallingConv::C) {
+      F->setCallingConv(CallingConv::Fast);
+      for (Value::use_iterator UI = F->use_begin(), E = F->use_end(); UI != E; ++UI) {
+        CallSite(*UI).setCallingConv(CallingConv::Fast);
+      }
+      FastccClones++;
+    }
+
+    std::vector<ArgKind> kinds;
+    bool changed = false;
+    for (Function::arg_iterator A = F->arg_begin(), E = F->arg_end(); A != E; ++A) {
+      if (A->use_empty()) kinds.push_back(DeadArg);
+      else if (isPromotable(A)) kinds.push_back(PromotedArg);
+      else kinds.push_back(KeptArg);
+      changed = changed || kinds.back() != KeptArg;
+    }
+    if (changed) rewriteArguments(F, kinds);
+  }
+
+  return !clones.empty();
+}
+
+// ============================= //
+
+void CloneABI::print(raw_ostream& O, const Module* M) const {
+  O << "Number of clones made internal: " << ClonesInternalized << '\n';
+  O << "Number of clones switched to fastcc: " << FastccClones << '\n';
+  O << "Number of unused clone arguments removed: " << DeadArgsRemoved << '\n';
+  O << "Number of clone arguments passed by value: " << ArgsPromoted << '\n';
+}
+
+// ============================= //
+
+// Whether every use of F is a call to it, so all its calls can be changed
+bool CloneABI::hasOnlyDirectCalls(Function *F) {
+  for (Value::use_iterator UI = F->use_begin(), E = F->use_end(); UI != E; ++UI) {
+    CallSite CS(*UI);
+    if (!CS || !CS.isCallee(UI) || CS.arg_size() != F->arg_size()) return false;
+  }
+  return true;
+}
+
+// ============================= //
+
+// Whether A points to a scalar only loaded at the start of the entry block,
+// before anything that may write memory or not return. The callers may
+// then load it themselves: every call would have, and would have read the
+// same value.
+bool CloneABI::isPromotable(Argument *A) {
+  PointerType *PT = dyn_cast<PointerType>(A->getType());
+  if (!PT || !PT->getElementType()->isSingleValueType()) return false;
+  if (A->hasByValAttr() || A->hasNestAttr()) return false;
+
+  BasicBlock *Entry = &A->getParent()->getEntryBlock();
+  std::set<Instruction*> loads;
+  for (Value::use_iterator UI = A->use_begin(), E = A->use_end(); UI != E; ++UI) {
+    LoadInst *L = dyn_cast<LoadInst>(*UI);
+    if (!L || !L->isSimple() || L->getParent() != Entry || L->getType() != PT->getElementType()) return false;
+    loads.insert(L);
+  }
+
+  for (BasicBlock::iterator I = Entry->begin(); !loads.empty(); ++I) {
+    if (loads.erase(&*I)) continue;
+    if (I->mayWriteToMemory() || isa<CallInst>(I) || isa<InvokeInst>(I)) return false;
+  }
+  return true;
+}
+
+// ============================= //
+
+// Attributes of F, or of a call to it, once its dead arguments are gone.
+// Promoted arguments lose their attributes, which were about the pointer.
+AttributeSet CloneABI::remapAttributes(const AttributeSet &PAL, LLVMContext &Ctx, const std::vector<ArgKind> &kinds) {
+  SmallVector<AttributeSet, 8> attrs;
+  if (PAL.hasAttributes(AttributeSet::ReturnIndex)) attrs.push_back(PAL.getRetAttributes());
+
+  unsigned index = 1;
+  for (unsigned i = 0; i < kinds.size(); ++i) {
+    if (kinds[i] == DeadArg) continue;
+    if (kinds[i] == KeptArg && PAL.hasAttributes(i + 1)) {
+      AttrBuilder B(PAL, i + 1);
+      attrs.push_back(AttributeSet::get(Ctx, index, B));
+    }
+    ++index;
+  }
+
+  if (PAL.hasAttributes(AttributeSet::FunctionIndex)) attrs.push_back(PAL.getFnAttributes());
+  return AttributeSet::get(Ctx, attrs);
+}
+
+// ============================= //
+
+// Replace F by a function without its dead arguments, and taking the
+// values its promoted arguments point to, and update its calls
+void CloneABI::rewriteArguments(Function *F, const std::vector<ArgKind> &kinds) {
+  std::vector<Type*> params;
+  std::vector<unsigned> alignments(kinds.size(), 0);
+  Function::arg_iterator A = F->arg_begin();
+  for (unsigned i = 0; i < kinds.size(); ++i, ++A) {
+    if (kinds[i] == KeptArg) params.push_back(A->getType());
+    if (kinds[i] == PromotedArg) {
+      params.push_back(cast<PointerType>(A->getType())->getElementType());
+      alignments[i] = cast<LoadInst>(*A->use_begin())->getAlignment();
+    }
+  }
+  FunctionType *NFTy = FunctionType::get(F->getReturnType(), params, false);
+
+  Function *NF = Function::Create(NFTy, F->getLinkage());
+  NF->copyAttributesFrom(F);
+  NF->setAttributes(remapAttributes(F->getAttributes(), F->getContext(), kinds));
+  NF->takeName(F);
+  F->getParent()->getFunctionList().insert(F, NF);
+  NF->getBasicBlockList().splice(NF->begin(), F->getBasicBlockList());
+
+  Function::arg_iterator NA = NF->arg_begin();
+  A = F->arg_begin();
+  for (unsigned i = 0; i < kinds.size(); ++i, ++A) {
+    if (kinds[i] == DeadArg) {
+      DeadArgsRemoved++;
+      continue;
+    }
+
+    if (kinds[i] == KeptArg) {
+      A->replaceAllUsesWith(NA);
+    } else {
+      while (!A->use_empty()) {
+        LoadInst *L = cast<LoadInst>(A->use_back());
+        L->replaceAllUsesWith(NA);
+        L->eraseFromParent();
+      }
+      ArgsPromoted++;
+    }
+    NA->takeName(A);
+    ++NA;
+  }
+
+  // Calls from the body of NF, if it is recursive, are among these
+  std::vector<Instruction*> calls;
+  for (Value::use_iterator UI = F->use_begin(), E = F->use_end(); UI != E; ++UI) {
+    calls.push_back(cast<Instruction>(*UI));
+  }
+
+  for (std::vector<Instruction*>::iterator it = calls.begin(); it != calls.end(); ++it) {
+    Instruction *Call = *it;
+    CallSite CS(Call);
+
+    std::vector<Value*> actuals;
+    for (unsigned i = 0; i < kinds.size(); ++i) {
+      Value *actual = CS.getArgument(i);
+      if (kinds[i] == KeptArg) actuals.push_back(actual);
+      if (kinds[i] == PromotedArg) {
+        actuals.push_back(new LoadInst(actual, actual->getName() + ".val", false, alignments[i], Call));
+      }
+    }
+
+    AttributeSet attrs = remapAttributes(CS.getAttributes(), Call->getContext(), kinds);
+    Instruction *NC;
+    if (InvokeInst *II = dyn_cast<InvokeInst>(Call)) {
+      NC = InvokeInst::Create(NF, II->getNormalDest(), II->getUnwindDest(), actuals, "", Call);
+      cast<InvokeInst>(NC)->setCallingConv(NF->getCallingConv());
+      cast<InvokeInst>(NC)->setAttributes(attrs);
+    } else {
+      NC = CallInst::Create(NF, actuals, "", Call);
+      cast<CallInst>(NC)->setTailCall(cast<CallInst>(Call)->isTailCall());
+      cast<CallInst>(NC)->setCallingConv(NF->getCallingConv());
+      cast<CallInst>(NC)->setAttributes(attrs);
+    }
+    NC->setDebugLoc(Call->getDebugLoc());
+
+    if (!Call->use_empty()) Call->replaceAllUsesWith(NC);
+    NC->takeName(Call);
+    Call->eraseFromParent();
+  }
+
+  F->eraseFromParent();
+}
+
+// ============================= //
+
+// Register the pass to the LLVM framework
+char CloneABI::ID = 0;
+static RegisterPass<CloneABI> X("clone-abi", "Give clones a calling convention and arguments of their own.", false, false);
@@ -0,0 +1,78 @@
+#ifndef CBO_CLONE_NAMING_H
+#define CBO_CLONE_NAMING_H
+
+#include <string>
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Assembly/Writer.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalValue.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace llvm {
+
+  // Clones are named after a hash of the original symbol and of what was
+  // specialized, so two translation units specializing the same function in
+  // the same way produce the same clone, which the linker can then fold.
+  //
+  // This header is shared by several plugins, so it must stay header-only.
+
+  // 64-bit FNV-1a
+  inline uint64_t hashCloneData(StringRef data, uint64_t hash = 14695981039346656037ULL) {
+    for (size_t i = 0; i < data.size(); ++i) {
+      hash ^= (unsigned char)data[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  // Name of the clone of original with the given suffix (".constargs") and
+  // specialization signature. The hash is written in decimal, so the clone
+  // regexes (".constargs[0-9]+") still match.
+  inline std::string getCloneName(StringRef original, StringRef suffix, StringRef signature) {
+    uint64_t hash = hashCloneData(original);
+    hash = hashCloneData(StringRef("\0", 1), hash);
+    hash = hashCloneData(signature, hash);
+    return original.str() + suffix.str() + utostr(hash);
+  }
+
+  // Whether a constant means the same in every translation unit, i.e. it
+  // references no local or unnamed global.
+  inline bool isModuleIndependent(const Constant *C) {
+    if (isa<BlockAddress>(C)) return false;
+    if (const GlobalValue *GV = dyn_cast<GlobalValue>(C)) {
+      return GV->hasName() && !GV->hasLocalLinkage();
+    }
+    for (User::const_op_iterator O = C->op_begin(), OE = C->op_end(); O != OE; ++O) {
+      if (!isModuleIndependent(cast<Constant>(*O))) return false;
+    }
+    return true;
+  }
+
+  // Signature entry for an argument specialized to a constant. The type of
+  // the constant is the one of the argument, so it is left out: clone-decide,
+  // which only knows the value from the summaries, names clones this way too.
+  inline void appendConstantSignature(std::string &signature, unsigned argNo, const Constant *C, const Module *M) {
+    raw_string_ostream S(signature);
+    S << argNo << "=";
+    WriteAsOperand(S, C, false, M);
+    S << ";";
+    S.flush();
+  }
+
+  // Linkage of a clone of F. Clones of functions with a single definition
+  // across the program (external or ODR) are linkonce_odr, so identical
+  // clones get folded. Clones whose specialization only makes sense in
+  // this translation unit, and clones of functions that may be overridden,
+  // stay local.
+  inline GlobalValue::LinkageTypes getCloneLinkage(const Function *F, bool moduleIndependent = true) {
+    if (F->hasLocalLinkage()) return F->getLinkage();
+    if (!moduleIndependent || F->mayBeOverridden()) return GlobalValue::InternalLinkage;
+    return GlobalValue::LinkOnceODRLinkage;
+  }
+}
+
+#endif
@@ -2,17 +2,22 @@
 #include <unistd.h>
 #include <ios>
 #include <fstream>
+#include <set>
 #include <string>
 #include <iostream>
 
 #include "llvm/IR/Attributes.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalAlias.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Regex.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -25,16 +30,26 @@
 using namespace llvm;
 
 STATISTIC(OrphansDropped, "Number of ophan functions removed");
+STATISTIC(UnreachableDropped, "Number of unreachable functions and globals removed");
+
+static cl::opt<bool>
+CleanerWholeProgram("clones-cleaner-whole-program", cl::init(false),
+                    cl::desc("The module is the whole program: externally visible clones and originals may be removed"));
+
 class ClonesCleaner : public ModulePass {
 
   std::map<std::string, std::vector<Function*> > functions;
 
+  // Functions that belong to a family with at least one clone
+  std::set<Function*> cloneFamilies;
+
   public:
 
   static char ID;
 
   ClonesCleaner() : ModulePass(ID) {
      OrphansDropped = 0;
+     UnreachableDropped = 0;
   }
 
   // +++++ METHODS +++++ //
@@ -43,6 +58,10 @@ class ClonesCleaner : public ModulePass {
   void collectFunctions(Module &M);
   bool removeFunctionFusionGarbage(Module &M);
   bool removeOrphanFunctions();
+  bool removeUnreachableGlobals(Module &M);
+  bool isRoot(GlobalValue *GV);
+  void markConstant(Constant *C, std::set<GlobalValue*> &live,
+                    std::set<Constant*> &visited, std::vector<GlobalValue*> &worklist);
 };
 
 bool ClonesCleaner::runOnModule(Module &M) {
@@ -53,7 +72,13 @@ bool ClonesCleaner::runOnModule(Module &M) {
   modified = modified | removeOrphanFunctions();
   modified = modified | removeFunctionFusionGarbage(M);
 
-  return false;
+  // The removals above may have erased functions from the families, so
+  // collect them again before looking for unreachable code.
+  functions.clear();
+  collectFunctions(M);
+  modified = modified | removeUnreachableGlobals(M);
+
+  return modified;
 }
 
 void ClonesCleaner::collectFunctions(Module &M) {
@@ -61,7 +86,7 @@ void ClonesCleaner::collectFunctions(Module &M) {
     if (!F->isDeclaration()) {
       std::string fnName = F->getName();
 
-      Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret))+");
+      Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret)|(\\.nofree[0-9]+)|(\\.nonnull[0-9]+)|(\\.scalar[0-9]+)|(\\.nounwind[0-9]+))+");
       Regex fusedEnding("\\.fused_[0-9]+$");
       bool isFused  = fusedEnding.match(fnName);
       bool isCloned = ending.match(fnName);
@@ -71,6 +96,10 @@ void ClonesCleaner::collectFunctions(Module &M) {
         Regex noaliasend("\\.noalias");
         Regex constargsend("\\.constargs[0-9]+");
         Regex noretend("\\.noret");
+        Regex nofreeend("\\.nofree[0-9]+");
+        Regex nonnullend("\\.nonnull[0-9]+");
+        Regex scalarend("\\.scalar[0-9]+");
+        Regex nounwindend("\\.nounwind[0-9]+");
         Regex deadstoresend("\\.deadstores[0-9]+");
 
         if (noaliasend.match(fnName)) {
@@ -82,6 +111,18 @@ void ClonesCleaner::collectFunctions(Module &M) {
         if (noretend.match(fnName)) {
           originalName = noretend.sub("", originalName);
         }
+        if (nofreeend.match(fnName)) {
+          originalName = nofreeend.sub("", originalName);
+        }
+        if (nonnullend.match(fnName)) {
+          originalName = nonnullend.sub("", originalName);
+        }
+        if (scalarend.match(fnName)) {
+          originalName = scalarend.sub("", originalName);
+        }
+        if (nounwindend.match(fnName)) {
+          originalName = nounwindend.sub("", originalName);
+        }
         if (deadstoresend.match(fnName)) {
            originalName = deadstoresend.sub("", originalName);
         }
@@ -104,7 +145,7 @@ void ClonesCleaner::collectFunctions(Module &M) {
 }
 
 bool ClonesCleaner::removeOrphanFunctions() {
-  Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret))+");
+  Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret)|(\\.nofree[0-9]+)|(\\.nonnull[0-9]+)|(\\.scalar[0-9]+)|(\\.nounwind[0-9]+))+");
   Regex fusedEnding("\\.fused_[0-9]+$");
   bool modified = false;
 
@@ -150,6 +191,137 @@ bool ClonesCleaner::removeFunctionFusionGarbage(Module &M) {
 }
 
 
+/*
+ * Cloning redirects calls away from the originals, so an original may stay
+ * alive only because other dead code references it, e.g. mutually recursive
+ * functions whose external callers now call their clones. Mark everything
+ * reachable through the call and reference graph from the externally visible
+ * roots and sweep the remaining definitions.
+ */
+bool ClonesCleaner::removeUnreachableGlobals(Module &M) {
+  cloneFamilies.clear();
+  for(std::map<std::string, std::vector<Function*> >::iterator it = functions.begin();
+      it != functions.end(); ++it) {
+    if (it->second.size() > 1) {
+      cloneFamilies.insert(it->second.begin(), it->second.end());
+    }
+  }
+
+  std::set<GlobalValue*> live;
+  std::set<Constant*> visited;
+  std::vector<GlobalValue*> worklist;
+
+  // Collect roots
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (isRoot(F) && live.insert(F).second) worklist.push_back(F);
+  }
+  for (Module::global_iterator G = M.global_begin(), E = M.global_end(); G != E; ++G) {
+    if (isRoot(G) && live.insert(G).second) worklist.push_back(G);
+  }
+  for (Module::alias_iterator A = M.alias_begin(), E = M.alias_end(); A != E; ++A) {
+    if (isRoot(A) && live.insert(A).second) worklist.push_back(A);
+  }
+
+  // Mark everything the roots reference, directly or through constants
+  while (!worklist.empty()) {
+    GlobalValue *GV = worklist.back();
+    worklist.pop_back();
+
+    if (Function *F = dyn_cast<Function>(GV)) {
+      for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+        for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+          for (User::op_iterator O = I->op_begin(), OE = I->op_end(); O != OE; ++O) {
+            if (Constant *C = dyn_cast<Constant>(*O)) {
+              markConstant(C, live, visited, worklist);
+            }
+          }
+        }
+      }
+    } else if (GlobalVariable *G = dyn_cast<GlobalVariable>(GV)) {
+      if (G->hasInitializer()) markConstant(G->getInitializer(), live, visited, worklist);
+    } else if (GlobalAlias *A = dyn_cast<GlobalAlias>(GV)) {
+      if (A->getAliasee()) markConstant(A->getAliasee(), live, visited, worklist);
+    }
+  }
+
+  // Collect dead definitions. Only local globals can be removed, as anything
+  // else may be referenced by other modules.
+  std::vector<Function*> deadFunctions;
+  std::vector<GlobalVariable*> deadGlobals;
+  std::vector<GlobalAlias*> deadAliases;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!F->isDeclaration() && !live.count(F)) deadFunctions.push_back(F);
+  }
+  for (Module::global_iterator G = M.global_begin(), E = M.global_end(); G != E; ++G) {
+    if (!G->isDeclaration() && G->hasLocalLinkage() && !live.count(G)) deadGlobals.push_back(G);
+  }
+  for (Module::alias_iterator A = M.alias_begin(), E = M.alias_end(); A != E; ++A) {
+    if (A->hasLocalLinkage() && !live.count(A)) deadAliases.push_back(A);
+  }
+
+  // Dead values may reference each other in cycles, so drop every reference
+  // before erasing any of them.
+  for (std::vector<Function*>::iterator it = deadFunctions.begin(); it != deadFunctions.end(); ++it) {
+    DEBUG(errs() << "Unreachable function: " << (*it)->getName() << "\n");
+    (*it)->deleteBody();
+  }
+  for (std::vector<GlobalVariable*>::iterator it = deadGlobals.begin(); it != deadGlobals.end(); ++it) {
+    DEBUG(errs() << "Unreachable global: " << (*it)->getName() << "\n");
+    (*it)->setInitializer(0);
+  }
+  for (std::vector<GlobalAlias*>::iterator it = deadAliases.begin(); it != deadAliases.end(); ++it) {
+    (*it)->setAliasee(0);
+  }
+
+  for (std::vector<Function*>::iterator it = deadFunctions.begin(); it != deadFunctions.end(); ++it) {
+    (*it)->removeDeadConstantUsers();
+    (*it)->eraseFromParent();
+    UnreachableDropped++;
+  }
+  for (std::vector<GlobalVariable*>::iterator it = deadGlobals.begin(); it != deadGlobals.end(); ++it) {
+    (*it)->removeDeadConstantUsers();
+    (*it)->eraseFromParent();
+    UnreachableDropped++;
+  }
+  for (std::vector<GlobalAlias*>::iterator it = deadAliases.begin(); it != deadAliases.end(); ++it) {
+    (*it)->removeDeadConstantUsers();
+    (*it)->eraseFromParent();
+    UnreachableDropped++;
+  }
+
+  return !deadFunctions.empty() || !deadGlobals.empty() || !deadAliases.empty();
+}
+
+/*
+ * A global value is a root if it may be referenced from outside the module.
+ * Clones exported by clone-apply, and their originals, are called by other
+ * modules through declarations, so every externally visible function is a
+ * root. Only when the module is the whole program, after the final link,
+ * are functions from a clone family not roots: as in removeOrphanFunctions,
+ * their external calls are then the ones redirected by the cloning passes.
+ */
+bool ClonesCleaner::isRoot(GlobalValue *GV) {
+  if (GV->isDeclaration()) return true;
+  if (Function *F = dyn_cast<Function>(GV)) {
+    if (F->getName() == "main") return true;
+    if (CleanerWholeProgram && cloneFamilies.count(F)) return false;
+  }
+  return !GV->hasLocalLinkage();
+}
+
+void ClonesCleaner::markConstant(Constant *C, std::set<GlobalValue*> &live,
+                                 std::set<Constant*> &visited, std::vector<GlobalValue*> &worklist) {
+  if (GlobalValue *GV = dyn_cast<GlobalValue>(C)) {
+    if (live.insert(GV).second) worklist.push_back(GV);
+    return;
+  }
+  if (!visited.insert(C).second) return;
+  for (User::op_iterator O = C->op_begin(), OE = C->op_end(); O != OE; ++O) {
+    if (Constant *Op = dyn_cast<Constant>(*O)) {
+      markConstant(Op, live, visited, worklist);
+    }
+  }
+}
 
 // Register the pass to the LLVM framework
 char ClonesCleaner::ID = 0;
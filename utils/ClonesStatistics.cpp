@@ -168,7 +168,7 @@ void ClonesStatistics::collectFunctions(Function &F) {
 
   name2fn[fnName] = &F;
 
-  Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret))+");
+  Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret)|(\\.nofree[0-9]+)|(\\.nonnull[0-9]+)|(\\.scalar[0-9]+)|(\\.nounwind[0-9]+))+");
   bool isCloned = ending.match(fnName);
 
   Regex fusedEnding("\\.fused_[0-9]+$");
@@ -182,6 +182,10 @@ void ClonesStatistics::collectFunctions(Function &F) {
     Regex constargsend("\\.constargs[0-9]+");
     Regex deadstoresend("\\.deadstores[0-9]+");
     Regex noretend("\\.noret");
+    Regex nofreeend("\\.nofree[0-9]+");
+    Regex nonnullend("\\.nonnull[0-9]+");
+    Regex scalarend("\\.scalar[0-9]+");
+    Regex nounwindend("\\.nounwind[0-9]+");
 
     if (noaliasend.match(fnName)) {
       originalName = noaliasend.sub("", originalName);
@@ -192,6 +196,18 @@ void ClonesStatistics::collectFunctions(Function &F) {
     if (noretend.match(fnName)) {
       originalName = noretend.sub("", originalName);
     }
+    if (nofreeend.match(fnName)) {
+      originalName = nofreeend.sub("", originalName);
+    }
+    if (nonnullend.match(fnName)) {
+      originalName = nonnullend.sub("", originalName);
+    }
+    if (scalarend.match(fnName)) {
+      originalName = scalarend.sub("", originalName);
+    }
+    if (nounwindend.match(fnName)) {
+      originalName = nounwindend.sub("", originalName);
+    }
     if (deadstoresend.match(fnName)) {
       originalName = deadstoresend.sub("", originalName);
     }
@@ -341,7 +357,7 @@ void ClonesStatistics::getStatistics() {
     for (int i = 0; i < numFunctions; ++i) {
       Function* F = it->second[i];
       std::string fnName = F->getName();
-      Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret))+");
+      Regex ending(".*((\\.noalias)|(\\.constargs[0-9]+)|(\\.deadstores[0-9]+)|(\\.noret)|(\\.nofree[0-9]+)|(\\.nonnull[0-9]+)|(\\.scalar[0-9]+)|(\\.nounwind[0-9]+))+");
       bool isCloned = ending.match(fnName);
       if (isCloned) {
         clonedFns.push_back(F);
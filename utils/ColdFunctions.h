@@ -0,0 +1,31 @@
+#ifndef CBO_COLD_FUNCTIONS_H
+#define CBO_COLD_FUNCTIONS_H
+
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CallSite.h"
+
+namespace llvm {
+
+  // Functions that are effectively never run, as found by the cold-functions
+  // pass or as written by the programmer, carry the cold attribute. The
+  // cloning passes leave them alone, and every call they make, so compile
+  // time and code size are only spent on code that runs.
+  //
+  // This header is shared by several plugins, so it must stay header-only.
+
+  inline bool isColdFunction(const Function *F) {
+    return F->getAttributes().hasAttribute(AttributeSet::FunctionIndex, Attribute::Cold);
+  }
+
+  // Whether the call is not worth cloning for: it calls a cold function, or
+  // is made by one
+  inline bool isColdCall(CallSite CS) {
+    const Function *callee = CS.getCalledFunction();
+    if (callee && isColdFunction(callee)) return true;
+    return isColdFunction(CS.getInstruction()->getParent()->getParent());
+  }
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef CBO_COMPILE_BUDGET_H
+#define CBO_COMPILE_BUDGET_H
+
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/TimeValue.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace llvm {
+
+  // Time and memory budget of a pass. Passes check it at points where they
+  // can fall back to a cheaper strategy, and record every degradation they
+  // make so it can be reported. A zero limit means no limit.
+  //
+  // This header is shared by several plugins, so it must stay header-only.
+  class CompileBudget {
+
+    std::string passName;
+    sys::TimeValue start;
+    double seconds;
+    size_t bytes;
+    std::vector<std::string> degradations;
+
+   public:
+
+    CompileBudget(StringRef passName, unsigned seconds = 0, unsigned megabytes = 0)
+      : passName(passName), start(sys::TimeValue::now()), seconds(seconds),
+        bytes(size_t(megabytes) * 1024 * 1024) {}
+
+    // Limits usually come from command line options, which are only parsed
+    // after the pass is constructed.
+    void reset(unsigned seconds, unsigned megabytes) {
+      start         = sys::TimeValue::now();
+      this->seconds = seconds;
+      this->bytes   = size_t(megabytes) * 1024 * 1024;
+      degradations.clear();
+    }
+
+    double elapsed() const {
+      sys::TimeValue delta = sys::TimeValue::now() - start;
+      return delta.seconds() + delta.nanoseconds() / 1e9;
+    }
+
+    // Whether the budget, scaled by the given factor, has been spent. Passes
+    // with several fallbacks use factors above one for the later ones.
+    bool exceeded(double factor = 1.0) const {
+      if (seconds > 0 && elapsed() > seconds * factor) return true;
+      if (bytes > 0 && sys::Process::GetMallocUsage() > bytes * factor) return true;
+      return false;
+    }
+
+    // Record a degradation, warning about it the first time
+    void degrade(StringRef what) {
+      for (unsigned i = 0; i < degradations.size(); ++i) {
+        if (degradations[i] == what) return;
+      }
+      degradations.push_back(what.str());
+      errs() << "warning: " << passName << ": compile budget exceeded, " << what << "\n";
+    }
+
+    bool degraded() const { return !degradations.empty(); }
+
+    const std::vector<std::string>& getDegradations() const { return degradations; }
+
+    void print(raw_ostream &O) const {
+      for (unsigned i = 0; i < degradations.size(); ++i) {
+        O << "Degradation: " << degradations[i] << "\n";
+      }
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,405 @@
+#ifndef CBO_MOD_REF_SUMMARY_H
+#define CBO_MOD_REF_SUMMARY_H
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CallSite.h"
+
+namespace llvm {
+
+  // Memory read and written by a function, or by an instruction.
+  //
+  // Objects accessed directly are globals, arguments (the memory they point
+  // to) and, for instructions, the allocas and allocations of the function.
+  // Memory reached by following pointers loaded from an argument is kept
+  // by argument, so callers can tell it apart; everything else is unknown.
+  struct FunctionModRef {
+    std::set<const Value*> read, written;
+    std::set<const Value*> readThrough, writtenThrough;
+    bool readsUnknown, writesUnknown;
+
+    FunctionModRef() : readsUnknown(false), writesUnknown(false) {}
+
+    // Whether memory of unknown origin may be read or written
+    bool readsAny()  const { return readsUnknown  || !readThrough.empty(); }
+    bool writesAny() const { return writesUnknown || !writtenThrough.empty(); }
+
+    bool readsMemory()  const { return !read.empty()    || readsAny(); }
+    bool writesMemory() const { return !written.empty() || writesAny(); }
+
+    bool operator==(const FunctionModRef &O) const {
+      return readsUnknown == O.readsUnknown && writesUnknown == O.writesUnknown &&
+             read == O.read && written == O.written &&
+             readThrough == O.readThrough && writtenThrough == O.writtenThrough;
+    }
+    bool operator!=(const FunctionModRef &O) const { return !(*this == O); }
+  };
+
+  // Computes the mod/ref summaries of the functions of a module, bottom-up
+  // over the strongly connected components of the call graph, on demand.
+  // Summaries are cached until invalidate is called on the function or on
+  // one of its callees, which the cloning passes do for every function
+  // whose calls they redirect.
+  //
+  // This header is shared by several plugins, so it must stay header-only.
+  class ModRefSummary {
+
+    // Where a pointer may point: object == 0 is unknown memory, through
+    // means memory reached from the pointers stored in object
+    struct MemoryRoot {
+      const Value *object;
+      bool through;
+      MemoryRoot(const Value *object, bool through) : object(object), through(through) {}
+    };
+
+    std::map<const Function*, FunctionModRef> summaries;
+
+    // Tarjan's algorithm state
+    std::map<const Function*, unsigned> index, lowlink;
+    std::vector<Function*> stack;
+    std::set<const Function*> onStack;
+    unsigned nextIndex;
+
+    static bool isLocalObject(const Value *V) {
+      return isa<AllocaInst>(V) || isNoAliasCall(V);
+    }
+
+    void getRoots(Value *ptr, std::vector<MemoryRoot> &roots, unsigned depth = 0) {
+      SmallVector<Value*, 4> objects;
+      GetUnderlyingObjects(ptr, objects);
+
+      for (unsigned i = 0; i < objects.size(); ++i) {
+        Value *O = objects[i];
+
+        if (isa<GlobalVariable>(O) || isa<Argument>(O) || isLocalObject(O)) {
+          roots.push_back(MemoryRoot(O, false));
+        } else if (LoadInst *L = dyn_cast<LoadInst>(O)) {
+          std::vector<MemoryRoot> bases;
+          if (depth < 4) getRoots(L->getPointerOperand(), bases, depth + 1);
+          else bases.push_back(MemoryRoot(0, false));
+
+          for (unsigned j = 0; j < bases.size(); ++j) {
+            if (bases[j].object && isa<Argument>(bases[j].object)) {
+              roots.push_back(MemoryRoot(bases[j].object, true));
+            } else {
+              roots.push_back(MemoryRoot(0, false));
+            }
+          }
+        } else {
+          roots.push_back(MemoryRoot(0, false));
+        }
+      }
+    }
+
+    void addAccess(FunctionModRef &R, Value *ptr, bool write) {
+      std::vector<MemoryRoot> roots;
+      getRoots(ptr, roots);
+
+      for (unsigned i = 0; i < roots.size(); ++i) {
+        if (!roots[i].object) {
+          if (write) R.writesUnknown = true;
+          else R.readsUnknown = true;
+        } else if (roots[i].through) {
+          if (write) R.writtenThrough.insert(roots[i].object);
+          else R.readThrough.insert(roots[i].object);
+        } else {
+          if (write) R.written.insert(roots[i].object);
+          else R.read.insert(roots[i].object);
+        }
+      }
+    }
+
+    // Memory reached from actual through a callee's argument
+    void addAccessThrough(FunctionModRef &R, Value *actual, bool write) {
+      std::vector<MemoryRoot> roots;
+      getRoots(actual, roots);
+
+      for (unsigned i = 0; i < roots.size(); ++i) {
+        if (roots[i].object && isa<Argument>(roots[i].object)) {
+          if (write) R.writtenThrough.insert(roots[i].object);
+          else R.readThrough.insert(roots[i].object);
+        } else {
+          if (write) R.writesUnknown = true;
+          else R.readsUnknown = true;
+        }
+      }
+    }
+
+    // Arguments read and written by the library functions we know of, as
+    // bit masks
+    static bool getLibraryEffect(StringRef name, unsigned &reads, unsigned &writes) {
+      reads = writes = 0;
+      if (name == "malloc" || name == "calloc") return true;
+      if (name == "free")                                          { writes = 1; return true; }
+      if (name == "realloc")                                       { reads = 1; writes = 1; return true; }
+      if (name == "memcpy" || name == "memmove" ||
+          name == "strcpy" || name == "strncpy")                   { reads = 2; writes = 1; return true; }
+      if (name == "strcat" || name == "strncat")                   { reads = 3; writes = 1; return true; }
+      if (name == "memset")                                        { writes = 1; return true; }
+      if (name == "strlen")                                        { reads = 1; return true; }
+      if (name == "strcmp" || name == "strncmp" || name == "memcmp") { reads = 3; return true; }
+      return false;
+    }
+
+    void addCallEffect(CallSite CS, FunctionModRef &R) {
+      Instruction *I = CS.getInstruction();
+
+      if (isa<DbgInfoIntrinsic>(I)) return;
+      if (MemTransferInst *MTI = dyn_cast<MemTransferInst>(I)) {
+        addAccess(R, MTI->getRawDest(), true);
+        addAccess(R, MTI->getRawSource(), false);
+        return;
+      }
+      if (MemSetInst *MSI = dyn_cast<MemSetInst>(I)) {
+        addAccess(R, MSI->getRawDest(), true);
+        return;
+      }
+      if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(I)) {
+        switch (II->getIntrinsicID()) {
+          case Intrinsic::lifetime_start:
+          case Intrinsic::lifetime_end:
+          case Intrinsic::invariant_start:
+          case Intrinsic::invariant_end:
+            return;
+          default:
+            break;
+        }
+      }
+      if (CS.doesNotAccessMemory()) return;
+
+      Function *F = CS.getCalledFunction();
+
+      if (F && !F->isDeclaration() && !F->mayBeOverridden()) {
+        const FunctionModRef &S = get(F);
+
+        CallSite::arg_iterator actual = CS.arg_begin();
+        for (Function::arg_iterator A = F->arg_begin(), E = F->arg_end(); A != E && actual != CS.arg_end(); ++A, ++actual) {
+          if (S.read.count(A))           addAccess(R, *actual, false);
+          if (S.written.count(A))        addAccess(R, *actual, true);
+          if (S.readThrough.count(A))    addAccessThrough(R, *actual, false);
+          if (S.writtenThrough.count(A)) addAccessThrough(R, *actual, true);
+        }
+        for (std::set<const Value*>::const_iterator it = S.read.begin(); it != S.read.end(); ++it) {
+          if (isa<GlobalVariable>(*it)) R.read.insert(*it);
+        }
+        for (std::set<const Value*>::const_iterator it = S.written.begin(); it != S.written.end(); ++it) {
+          if (isa<GlobalVariable>(*it)) R.written.insert(*it);
+        }
+        R.readsUnknown  |= S.readsUnknown;
+        R.writesUnknown |= S.writesUnknown;
+        return;
+      }
+
+      unsigned reads, writes;
+      if (F && F->isDeclaration() && getLibraryEffect(F->getName(), reads, writes)) {
+        unsigned i = 0;
+        for (CallSite::arg_iterator it = CS.arg_begin(), E = CS.arg_end(); it != E && i < 32; ++it, ++i) {
+          if (reads & (1u << i))  addAccess(R, *it, false);
+          if (writes & (1u << i)) addAccess(R, *it, true);
+        }
+        return;
+      }
+
+      R.readsUnknown = true;
+      if (!CS.onlyReadsMemory()) R.writesUnknown = true;
+    }
+
+    // Summary of the body of F, with the current summaries of its callees
+    FunctionModRef summarize(Function *F) {
+      FunctionModRef body;
+      for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+        for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+          getEffect(I, body);
+        }
+      }
+
+      // Callers cannot see the memory local to F
+      FunctionModRef S = body;
+      S.read.clear();
+      S.written.clear();
+      for (std::set<const Value*>::iterator it = body.read.begin(); it != body.read.end(); ++it) {
+        if (!isLocalObject(*it)) S.read.insert(*it);
+      }
+      for (std::set<const Value*>::iterator it = body.written.begin(); it != body.written.end(); ++it) {
+        if (!isLocalObject(*it)) S.written.insert(*it);
+      }
+      return S;
+    }
+
+    void visit(Function *F) {
+      index[F] = lowlink[F] = nextIndex++;
+      stack.push_back(F);
+      onStack.insert(F);
+
+      for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+        for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+          CallSite CS(I);
+          if (!CS) continue;
+          Function *G = CS.getCalledFunction();
+          if (!G || G->isDeclaration() || G->mayBeOverridden() || summaries.count(G)) continue;
+
+          if (!index.count(G)) {
+            visit(G);
+            lowlink[F] = std::min(lowlink[F], lowlink[G]);
+          } else if (onStack.count(G)) {
+            lowlink[F] = std::min(lowlink[F], index[G]);
+          }
+        }
+      }
+
+      if (lowlink[F] != index[F]) return;
+
+      // F is the root of an SCC whose callees are all summarized. Iterate
+      // its summaries, which only grow, up to a fixed point.
+      std::vector<Function*> SCC;
+      Function *G;
+      do {
+        G = stack.back();
+        stack.pop_back();
+        onStack.erase(G);
+        SCC.push_back(G);
+        summaries[G] = FunctionModRef();
+      } while (G != F);
+
+      bool changed;
+      do {
+        changed = false;
+        for (unsigned i = 0; i < SCC.size(); ++i) {
+          FunctionModRef S = summarize(SCC[i]);
+          if (S != summaries[SCC[i]]) {
+            summaries[SCC[i]] = S;
+            changed = true;
+          }
+        }
+      } while (changed);
+    }
+
+   public:
+
+    ModRefSummary() : nextIndex(0) {}
+
+    const FunctionModRef& get(Function *F) {
+      std::map<const Function*, FunctionModRef>::iterator it = summaries.find(F);
+      if (it != summaries.end()) return it->second;
+
+      index.clear();
+      lowlink.clear();
+      nextIndex = 0;
+      visit(F);
+      return summaries[F];
+    }
+
+    // Drop the summaries of F and of everything that calls it
+    void invalidate(Function *F) {
+      std::vector<Function*> worklist(1, F);
+      while (!worklist.empty()) {
+        Function *G = worklist.back();
+        worklist.pop_back();
+        if (!summaries.erase(G)) continue;
+
+        for (Value::use_iterator UI = G->use_begin(), E = G->use_end(); UI != E; ++UI) {
+          CallSite CS(*UI);
+          if (CS && CS.isCallee(UI)) worklist.push_back(CS.getInstruction()->getParent()->getParent());
+        }
+      }
+    }
+
+    // Add the memory I may read or write to R, in terms of the function of I
+    void getEffect(Instruction *I, FunctionModRef &R) {
+      if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+        if (LI->isVolatile()) R.readsUnknown = R.writesUnknown = true;
+        else addAccess(R, LI->getPointerOperand(), false);
+      } else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+        if (SI->isVolatile()) R.readsUnknown = R.writesUnknown = true;
+        else addAccess(R, SI->getPointerOperand(), true);
+      } else if (AtomicCmpXchgInst *CXI = dyn_cast<AtomicCmpXchgInst>(I)) {
+        addAccess(R, CXI->getPointerOperand(), false);
+        addAccess(R, CXI->getPointerOperand(), true);
+      } else if (AtomicRMWInst *RMWI = dyn_cast<AtomicRMWInst>(I)) {
+        addAccess(R, RMWI->getPointerOperand(), false);
+        addAccess(R, RMWI->getPointerOperand(), true);
+      } else if (VAArgInst *VI = dyn_cast<VAArgInst>(I)) {
+        addAccess(R, VI->getPointerOperand(), false);
+        addAccess(R, VI->getPointerOperand(), true);
+      } else if (CallSite CS = CallSite(I)) {
+        addCallEffect(CS, R);
+      } else if (I->mayReadFromMemory() || I->mayWriteToMemory()) {
+        R.readsUnknown = R.writesUnknown = true;
+      }
+    }
+
+    // Whether memory outside the function may hold the address of V
+    static bool isEscaped(const Value *V) {
+      if (isLocalObject(V)) return PointerMayBeCaptured(V, true, true);
+      return true;
+    }
+
+    static bool mayAlias(const Value *A, const Value *B) {
+      if (A == B) return true;
+
+      bool identifiedA = isa<GlobalVariable>(A) || isLocalObject(A);
+      bool identifiedB = isa<GlobalVariable>(B) || isLocalObject(B);
+      if (identifiedA && identifiedB) return false;
+
+      // Arguments may point to anything but the locals nobody knows of
+      if (identifiedA && !isEscaped(A)) return false;
+      if (identifiedB && !isEscaped(B)) return false;
+      return true;
+    }
+
+    // Whether B may access memory written by A, the objects or, if any,
+    // memory of unknown origin
+    static bool mayTouchWritten(const std::set<const Value*> &objects, bool any, const FunctionModRef &B) {
+      bool accessesAny = B.readsAny() || B.writesAny();
+      std::set<const Value*> accessed(B.read.begin(), B.read.end());
+      accessed.insert(B.written.begin(), B.written.end());
+
+      if (any && accessesAny) return true;
+      for (std::set<const Value*>::const_iterator it = accessed.begin(); it != accessed.end(); ++it) {
+        if (any && isEscaped(*it)) return true;
+        for (std::set<const Value*>::const_iterator O = objects.begin(); O != objects.end(); ++O) {
+          if (mayAlias(*O, *it)) return true;
+        }
+      }
+      for (std::set<const Value*>::const_iterator O = objects.begin(); O != objects.end(); ++O) {
+        if (accessesAny && isEscaped(*O)) return true;
+      }
+      return false;
+    }
+
+    // Whether two effects of the same function may not be reordered
+    static bool mayConflict(const FunctionModRef &A, const FunctionModRef &B) {
+      return mayTouchWritten(A.written, A.writesAny(), B) ||
+             mayTouchWritten(B.written, B.writesAny(), A);
+    }
+
+    // Whether I may read the memory ptr points to
+    bool mayRead(Instruction *I, Value *ptr) {
+      FunctionModRef E;
+      getEffect(I, E);
+      if (!E.readsMemory()) return false;
+
+      FunctionModRef P;
+      addAccess(P, ptr, true);
+      FunctionModRef reads;
+      reads.read = E.read;
+      reads.readThrough = E.readThrough;
+      reads.readsUnknown = E.readsUnknown;
+      return mayTouchWritten(P.written, P.writesAny(), reads);
+    }
+  };
+}
+
+#endif
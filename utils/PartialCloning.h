@@ -0,0 +1,133 @@
+#ifndef CBO_PARTIAL_CLONING_H
+#define CBO_PARTIAL_CLONING_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/Dominators.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
+
+namespace llvm {
+
+  // Partial cloning: before a function is cloned, its cold regions are
+  // moved into functions of their own, which the original and all of its
+  // clones then call, so a clone only duplicates the hot part of the body.
+  // A region is a subtree of the dominator tree, which has a single entry,
+  // whose blocks all run less than the given ratio of the calls to the
+  // function. Regions that return from the function are left in place.
+  //
+  // This header is shared by several plugins, so it must stay header-only.
+  class PartialCloning {
+
+    struct CloneSize {
+      std::string name;
+      unsigned instructions;
+      unsigned outlined;
+    };
+
+    // Instructions moved out of each function that was looked at
+    std::map<Function*, unsigned> outlined;
+    std::vector<CloneSize> clones;
+
+    static unsigned countInstructions(const Function &F) {
+      unsigned count = 0;
+      for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+        count += BB->size();
+      }
+      return count;
+    }
+
+    // Collect the largest cold subtrees below N
+    static void findColdRegions(DomTreeNode *N, BlockFrequencyInfo &BFI, uint64_t threshold,
+                                std::vector<std::vector<BasicBlock*> > &regions) {
+      std::vector<BasicBlock*> region;
+      std::vector<DomTreeNode*> worklist(1, N);
+      bool cold = N->getIDom() != 0;
+
+      while (cold && !worklist.empty()) {
+        DomTreeNode *M = worklist.back();
+        worklist.pop_back();
+        BasicBlock *BB = M->getBlock();
+
+        TerminatorInst *T = BB->getTerminator();
+        cold = BFI.getBlockFreq(BB).getFrequency() < threshold &&
+               !isa<ReturnInst>(T) && !isa<ResumeInst>(T) && !BB->isLandingPad();
+
+        region.push_back(BB);
+        worklist.insert(worklist.end(), M->begin(), M->end());
+      }
+
+      if (cold) {
+        regions.push_back(region);
+        return;
+      }
+      for (DomTreeNode::iterator C = N->begin(), E = N->end(); C != E; ++C) {
+        findColdRegions(*C, BFI, threshold, regions);
+      }
+    }
+
+   public:
+
+    // Move the regions of F that run less than coldRatio times per call,
+    // and have at least minSize instructions, into functions of their own.
+    // F is only looked at once. Returns the number of instructions moved.
+    unsigned outlineColdRegions(Function &F, BlockFrequencyInfo &BFI, DominatorTree &DT,
+                                double coldRatio, unsigned minSize = 8) {
+      if (outlined.count(&F)) return outlined[&F];
+
+      uint64_t entry = BFI.getBlockFreq(&F.getEntryBlock()).getFrequency();
+      uint64_t threshold = uint64_t(entry * coldRatio);
+
+      std::vector<std::vector<BasicBlock*> > regions;
+      if (threshold > 0) findColdRegions(DT.getRootNode(), BFI, threshold, regions);
+
+      unsigned moved = 0;
+      for (unsigned i = 0; i < regions.size(); ++i) {
+        unsigned size = 0;
+        for (unsigned j = 0; j < regions[i].size(); ++j) size += regions[i][j]->size();
+        if (size < minSize) continue;
+
+        // The dominator tree is not kept up to date while regions are moved
+        CodeExtractor CE(regions[i]);
+        if (!CE.isEligible()) continue;
+
+        Function *Cold = CE.extractCodeRegion();
+        if (!Cold) continue;
+
+        Cold->setName(F.getName() + ".cold");
+        Cold->addFnAttr(Attribute::Cold);
+        Cold->addFnAttr(Attribute::NoInline);
+        moved += size;
+      }
+
+      outlined[&F] = moved;
+      return moved;
+    }
+
+    // Record the size of Clone, made from Original after its cold regions
+    // were moved out
+    void recordClone(Function *Clone, Function *Original) {
+      CloneSize S;
+      S.name         = Clone->getName();
+      S.instructions = countInstructions(*Clone);
+      S.outlined     = outlined.count(Original) ? outlined[Original] : 0;
+      clones.push_back(S);
+    }
+
+    void print(raw_ostream &O) const {
+      for (unsigned i = 0; i < clones.size(); ++i) {
+        O << "Clone " << clones[i].name << ": " << clones[i].instructions << " instructions";
+        if (clones[i].outlined) O << ", " << clones[i].outlined << " left in cold regions";
+        O << "\n";
+      }
+    }
+  };
+}
+
+#endif